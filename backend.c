@@ -0,0 +1,184 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "backend.h"
+#include "util.h"
+
+#define BUTTONMASK              (ButtonPressMask|ButtonReleaseMask)
+
+static Display *dpy;
+
+static void
+xlib_border(Window w, unsigned long pixel)
+{
+	XSetWindowBorder(dpy, w, pixel);
+}
+
+static void
+xlib_configure(Window w, unsigned int mask, XWindowChanges *wc)
+{
+	XConfigureWindow(dpy, w, mask, wc);
+}
+
+static void
+xlib_delprop(Window w, Atom prop)
+{
+	XDeleteProperty(dpy, w, prop);
+}
+
+static void
+xlib_focus(Window w)
+{
+	XSetInputFocus(dpy, w, RevertToPointerRoot, CurrentTime);
+}
+
+/* sync: freeze the pointer until the click is replayed or passed on */
+static void
+xlib_grabbutton(Window w, unsigned int button, unsigned int mod, int sync)
+{
+	XGrabButton(dpy, button, mod, w, False, BUTTONMASK,
+		sync ? GrabModeSync : GrabModeAsync, GrabModeSync, None, None);
+}
+
+static int
+xlib_hasprotocol(Window w, Atom proto)
+{
+	Atom *protocols;
+	int n, exists = 0;
+
+	if (XGetWMProtocols(dpy, w, &protocols, &n)) {
+		while (!exists && n--)
+			exists = protocols[n] == proto;
+		XFree(protocols);
+	}
+	return exists;
+}
+
+static void
+xlib_move(Window w, int x, int y)
+{
+	XMoveWindow(dpy, w, x, y);
+}
+
+static void
+xlib_raise(Window w)
+{
+	XRaiseWindow(dpy, w);
+}
+
+static void
+xlib_send(Window w, long mask, XEvent *ev)
+{
+	XSendEvent(dpy, w, False, mask, ev);
+}
+
+static void
+xlib_setprop(Window w, Atom prop, Atom type, const void *data, int n)
+{
+	XChangeProperty(dpy, w, prop, type, 32, PropModeReplace, (unsigned char *)data, n);
+}
+
+static void
+xlib_seturgent(Window w, int urg)
+{
+	XWMHints *wmh;
+
+	if (!(wmh = XGetWMHints(dpy, w)))
+		return;
+	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
+	XSetWMHints(dpy, w, wmh);
+	XFree(wmh);
+}
+
+/* returns the pid of the command, which the intermediate child passes
+ * back through a pipe, 0 if that got lost, or -1 if fork failed */
+static pid_t
+xlib_spawn(const char **argv)
+{
+	struct sigaction sa;
+	pid_t pid, cmd = 0;
+	int fds[2] = { -1, -1 };
+
+	if (pipe(fds) == 0) {
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	}
+	if ((pid = fork()) == 0) {
+		if (dpy)
+			close(ConnectionNumber(dpy));
+		setsid();
+
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = 0;
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGCHLD, &sa, NULL);
+		sigaction(SIGPIPE, &sa, NULL);
+
+		/* the command is orphaned at once and reaped by init, so only
+		 * helpers ever become zombies of ours */
+		if ((cmd = fork()) != 0) {
+			if (cmd > 0 && fds[1] >= 0)
+				write(fds[1], &cmd, sizeof cmd);
+			_exit(0);
+		}
+		execvp(argv[0], (char **)argv);
+		die("DINA: execvp '%s' failed:", argv[0]);
+	}
+	if (fds[1] >= 0)
+		close(fds[1]);
+	if (pid > 0) {
+		waitpid(pid, NULL, 0);
+		if (fds[0] < 0 || read(fds[0], &cmd, sizeof cmd) != sizeof cmd)
+			cmd = 0;
+	}
+	if (fds[0] >= 0)
+		close(fds[0]);
+	return pid > 0 ? cmd : pid;
+}
+
+/* dropenter: forget the EnterNotify events the requests so far caused */
+static void
+xlib_sync(int dropenter)
+{
+	XEvent ev;
+
+	XSync(dpy, False);
+	if (dropenter)
+		while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+}
+
+static void
+xlib_ungrabbuttons(Window w)
+{
+	XUngrabButton(dpy, AnyButton, AnyModifier, w);
+}
+
+const Backend xlib = {
+	.border = xlib_border,
+	.configure = xlib_configure,
+	.delprop = xlib_delprop,
+	.focus = xlib_focus,
+	.grabbutton = xlib_grabbutton,
+	.hasprotocol = xlib_hasprotocol,
+	.move = xlib_move,
+	.raise = xlib_raise,
+	.send = xlib_send,
+	.setprop = xlib_setprop,
+	.seturgent = xlib_seturgent,
+	.spawn = xlib_spawn,
+	.sync = xlib_sync,
+	.ungrabbuttons = xlib_ungrabbuttons,
+};
+
+void
+xlib_init(Display *d)
+{
+	dpy = d;
+}
@@ -0,0 +1,25 @@
+/* See LICENSE file for copyright and license details. */
+
+/* The requests the window management core sends the X server and the
+ * commands it starts. xlib below is the real thing; benchmarks put an
+ * in-memory fake in its place and run the core without a display. */
+typedef struct {
+	void (*border)(Window w, unsigned long pixel);
+	void (*configure)(Window w, unsigned int mask, XWindowChanges *wc);
+	void (*delprop)(Window w, Atom prop);
+	void (*focus)(Window w);
+	void (*grabbutton)(Window w, unsigned int button, unsigned int mod, int sync);
+	int (*hasprotocol)(Window w, Atom proto);
+	void (*move)(Window w, int x, int y);
+	void (*raise)(Window w);
+	void (*send)(Window w, long mask, XEvent *ev);
+	void (*setprop)(Window w, Atom prop, Atom type, const void *data, int n); /* format 32 */
+	void (*seturgent)(Window w, int urg);
+	pid_t (*spawn)(const char **argv); /* the command's pid, 0 if unknown */
+	void (*sync)(int dropenter);
+	void (*ungrabbuttons)(Window w);
+} Backend;
+
+extern const Backend xlib;
+
+void xlib_init(Display *dpy);
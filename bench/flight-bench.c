@@ -0,0 +1,53 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Times flight_record() and a full flight_dump():
+ *
+ *	flight-bench 10000000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../flight.h"
+#include "../util.h"
+
+static double
+elapsed(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char path[] = "/tmp/flight-bench-XXXXXX";
+	struct timespec t0;
+	double t;
+	long i, n = 0;
+	int fd;
+
+	if (argc < 2 || (n = atol(argv[1])) <= 0)
+		die("usage: flight-bench records");
+	if ((fd = mkstemp(path)) < 0)
+		die("flight-bench: mkstemp:");
+	close(fd);
+	flight_init(path);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		flight_record(i % 8 ? FlightEvent : FlightKey, 2 + i % 34, 0x1200000 + i % 64,
+			i % 8 ? NULL : "focusstack");
+	t = elapsed(&t0);
+	printf("%10ld records: %7.1f ns/record\n", n, t * 1e6 / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (flight_dump() < 0)
+		die("flight-bench: %s:", path);
+	printf("%10s dump:    %7.3f ms\n", "", elapsed(&t0));
+	unlink(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Loads generated workspace_layout files of the given sizes and times the
+ * load and a lookup of every entry:
+ *
+ *	persist-bench 10 1000 100000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../persist.h"
+#include "../util.h"
+
+static double
+elapsed(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static void
+generate(const char *path, int n)
+{
+	FILE *f;
+	int i;
+
+	if (!(f = fopen(path, "w")))
+		die("persist-bench: %s:", path);
+	fputs("# DINA Workspace Layout Configuration\n", f);
+	for (i = 0; i < n; i++)
+		fprintf(f, "Lab-Application-%d|lab-application-instance-%d|%d\n", i, i, 2 + i % 8);
+	if (fclose(f) == EOF)
+		die("persist-bench: %s:", path);
+}
+
+static void
+bench(const char *path, int n)
+{
+	Persist p = { 0 };
+	struct timespec t0;
+	char class[64], instance[64];
+	double load = 1e9, t;
+	int i, r, found = 0, runs = n > 10000 ? 5 : 50;
+
+	generate(path, n);
+	for (r = 0; r < runs; r++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (persist_load(&p, path) != n)
+			die("persist-bench: loaded %d of %d entries", p.n, n);
+		if ((t = elapsed(&t0)) < load)
+			load = t;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		snprintf(class, sizeof class, "Lab-Application-%d", i);
+		snprintf(instance, sizeof instance, "lab-application-instance-%d", i);
+		found += persist_find(&p, class, strlen(class), instance, strlen(instance),
+			persist_hash(class, strlen(class), instance, strlen(instance))) >= 0;
+	}
+	t = elapsed(&t0);
+	if (found != n)
+		die("persist-bench: found %d of %d entries", found, n);
+	printf("%8d entries: load %9.3f ms (best of %d), lookup %7.1f ns/entry\n",
+		n, load, runs, t * 1e6 / n);
+	persist_free(&p);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char path[] = "/tmp/persist-bench-XXXXXX";
+	int i, fd;
+
+	if (argc < 2)
+		die("usage: persist-bench entries...");
+	if ((fd = mkstemp(path)) < 0)
+		die("persist-bench: mkstemp:");
+	close(fd);
+	for (i = 1; i < argc; i++)
+		bench(path, atoi(argv[i]));
+	unlink(path);
+	return EXIT_SUCCESS;
+}
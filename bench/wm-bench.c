@@ -0,0 +1,377 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Runs the window management core of DINA against an in-memory backend,
+ * which records requests instead of sending them, so no display is needed.
+ * Checks rules, tagging, focus and monocle against the recorded requests,
+ * then times rule matching, focus, view and tag switches, arranging and
+ * layout writes over the given number of clients; 0 ops only checks:
+ *
+ *	wm-bench 50 1000000
+ */
+#define main dina_main
+#include "../dwm.c"
+#undef main
+
+enum { FakeBorder, FakeConfigure, FakeDelprop, FakeFocus, FakeGrabbutton,
+       FakeHasprotocol, FakeMove, FakeRaise, FakeSend, FakeSetprop,
+       FakeSeturgent, FakeSpawn, FakeSync, FakeUngrabbuttons, FakeLast };
+
+static unsigned long requests[FakeLast];
+static struct { int kind; Window w; } reqlog[256]; /* the first requests since nreqlog = 0 */
+static int nreqlog;
+static int nchecks;
+
+static void
+record(int kind, Window w)
+{
+	requests[kind]++;
+	if (nreqlog < LENGTH(reqlog)) {
+		reqlog[nreqlog].kind = kind;
+		reqlog[nreqlog].w = w;
+	}
+	nreqlog++;
+}
+
+static void
+fake_border(Window w, unsigned long pixel)
+{
+	record(FakeBorder, w);
+}
+
+static void
+fake_configure(Window w, unsigned int mask, XWindowChanges *wc)
+{
+	record(FakeConfigure, w);
+}
+
+static void
+fake_delprop(Window w, Atom prop)
+{
+	record(FakeDelprop, w);
+}
+
+static void
+fake_focus(Window w)
+{
+	record(FakeFocus, w);
+}
+
+static void
+fake_grabbutton(Window w, unsigned int button, unsigned int mod, int sync)
+{
+	record(FakeGrabbutton, w);
+}
+
+static int
+fake_hasprotocol(Window w, Atom proto)
+{
+	record(FakeHasprotocol, w);
+	return proto == wmatom[WMTakeFocus] && w & 1; /* every other client */
+}
+
+static void
+fake_move(Window w, int x, int y)
+{
+	record(FakeMove, w);
+}
+
+static void
+fake_raise(Window w)
+{
+	record(FakeRaise, w);
+}
+
+static void
+fake_send(Window w, long mask, XEvent *ev)
+{
+	record(FakeSend, w);
+}
+
+static void
+fake_setprop(Window w, Atom prop, Atom type, const void *data, int n)
+{
+	record(FakeSetprop, w);
+}
+
+static void
+fake_seturgent(Window w, int urg)
+{
+	record(FakeSeturgent, w);
+}
+
+static pid_t
+fake_spawn(const char **argv)
+{
+	record(FakeSpawn, 0);
+	return 0;
+}
+
+static void
+fake_sync(int dropenter)
+{
+	record(FakeSync, 0);
+}
+
+static void
+fake_ungrabbuttons(Window w)
+{
+	record(FakeUngrabbuttons, w);
+}
+
+static const Backend fake = {
+	.border = fake_border,
+	.configure = fake_configure,
+	.delprop = fake_delprop,
+	.focus = fake_focus,
+	.grabbutton = fake_grabbutton,
+	.hasprotocol = fake_hasprotocol,
+	.move = fake_move,
+	.raise = fake_raise,
+	.send = fake_send,
+	.setprop = fake_setprop,
+	.seturgent = fake_seturgent,
+	.spawn = fake_spawn,
+	.sync = fake_sync,
+	.ungrabbuttons = fake_ungrabbuttons,
+};
+
+static Client **clients;
+static int nclients;
+
+static double
+elapsed(struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static void
+expect(int ok, const char *what)
+{
+	if (!ok)
+		die("wm-bench: check failed: %s", what);
+	nchecks++;
+}
+
+/* the requests focus(c) sends when old had the focus */
+static int
+expectfocus(Client *old, Client *c, int *kinds, Window *wins, int max)
+{
+	int n = 0, i, j, pass;
+	Client *b;
+
+	for (pass = 0; pass < 2; pass++) {
+		b = pass ? c : old;
+		kinds[n] = FakeUngrabbuttons, wins[n++] = b->win;
+		if (!pass)
+			kinds[n] = FakeGrabbutton, wins[n++] = b->win;
+		for (i = 0; i < LENGTH(buttons); i++)
+			if (buttons[i].click == ClkClientWin)
+				for (j = 0; j < 4 && n < max - 8; j++)
+					kinds[n] = FakeGrabbutton, wins[n++] = b->win;
+		kinds[n] = FakeBorder, wins[n++] = b->win;
+	}
+	kinds[n] = FakeFocus, wins[n++] = c->win;
+	kinds[n] = FakeSetprop, wins[n++] = root;
+	kinds[n] = FakeHasprotocol, wins[n++] = c->win;
+	if (c->win & 1) /* see fake_hasprotocol() */
+		kinds[n] = FakeSend, wins[n++] = c->win;
+	return n;
+}
+
+static void
+check(void)
+{
+	Client *c, *old, *next;
+	int kinds[LENGTH(reqlog)], i, n, idx;
+	Window wins[LENGTH(reqlog)];
+
+	/* persisted applications land on their tag, the others on the view */
+	applyrules(clients[7]);
+	expect(clients[7]->tags == 1 << 1, "applyrules() uses the persisted tag");
+	applyrules(clients[0]);
+	expect(clients[0]->tags == selmon->tagset[selmon->seltags], "applyrules() defaults to the view");
+	clients[7]->tags = clients[0]->tags = 1;
+
+	/* every third window hidden, for the walks to skip */
+	for (i = 0; i < nclients; i += 3)
+		clients[i]->tags = 1 << 2;
+	arrange(selmon);
+	for (c = selmon->clients; c; c = c->next)
+		if (ISVISIBLE(c))
+			expect(c->w == selmon->ww - 2 * c->bw && c->h == selmon->wh - 2 * c->bw,
+				"monocle() fills the monitor");
+
+	for (c = selmon->clients; c && !ISVISIBLE(c); c = c->next);
+	focus(c);
+	for (i = 0; i < nclients; i++) {
+		for (next = c->next; next && !ISVISIBLE(next); next = next->next);
+		if (!next)
+			for (next = selmon->clients; !ISVISIBLE(next); next = next->next);
+		focusstack(&(Arg){ .i = +1 });
+		expect(selmon->sel == next, "focusstack(+1) follows the client list");
+		focusstack(&(Arg){ .i = -1 });
+		expect(selmon->sel == c, "focusstack(-1) goes back");
+		focusstack(&(Arg){ .i = +1 });
+		c = next;
+	}
+
+	old = selmon->sel;
+	for (c = selmon->clients; c && (c == old || !ISVISIBLE(c) || !(c->win & 1)); c = c->next);
+	n = expectfocus(old, c, kinds, wins, LENGTH(kinds));
+	nreqlog = 0;
+	focus(c);
+	expect(nreqlog == n, "focus() sends as many requests as expected");
+	for (i = 0; i < n && i < nreqlog; i++)
+		expect(reqlog[i].kind == kinds[i] && reqlog[i].w == wins[i], "focus() sends the expected requests");
+
+	/* tag() moves the window and remembers its application, tag 1 forgets */
+	tag(&(Arg){ .ui = 1 << 4 });
+	expect(c->tags == 1 << 4 && selmon->sel != c, "tag() moves the window away");
+	idx = findapptagpersist(c->cold->class, c->cold->instance, c->cold->classhash);
+	expect(idx >= 0 && layout.entries[idx].tag == 5, "tag() updates the layout");
+	view(&(Arg){ .ui = 1 << 4 });
+	expect(selmon->sel == c, "view() finds the moved window");
+	tag(&(Arg){ .ui = 1 });
+	expect(findapptagpersist(c->cold->class, c->cold->instance, c->cold->classhash) < 0,
+		"tag() to 1 forgets the application");
+	view(&(Arg){ .ui = 1 });
+
+	for (i = 0; i < nclients; i++)
+		clients[i]->tags = 1;
+	focus(NULL);
+	arrange(selmon);
+	printf("%d checks passed\n", nchecks);
+}
+
+static void
+opapplyrules(long i)
+{
+	applyrules(clients[i % nclients]);
+}
+
+static void
+oparrange(long i)
+{
+	arrange(selmon);
+}
+
+static void
+opfocusstack(long i)
+{
+	focusstack(&(Arg){ .i = i % 3 ? +1 : -1 });
+}
+
+static void
+oppersist(long i)
+{
+	Client *c = clients[i % nclients];
+
+	updateapptagpersist(c->cold->class, c->cold->instance, 1 + i % 9);
+}
+
+/* view shows tags 1 and 2, so the window stays visible */
+static void
+optag(long i)
+{
+	tag(&(Arg){ .ui = 1 << (i & 1) });
+}
+
+static void
+opview(long i)
+{
+	view(&(Arg){ .ui = 1 << i % 3 });
+}
+
+static void
+bench(const char *name, void (*op)(long), long n)
+{
+	struct timespec t0;
+	unsigned long total = 0;
+	double t;
+	long i;
+	int j;
+
+	memset(requests, 0, sizeof requests);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		op(i);
+	t = elapsed(&t0);
+	for (j = 0; j < FakeLast; j++)
+		total += requests[j];
+	printf("%-12s %8.1f ns/op %10.0f ops/s %6.2f requests/op\n",
+		name, t * 1e6 / n, n / t * 1e3, (double)total / n);
+}
+
+static void
+setupfake(int n)
+{
+	char class[32], instance[32], title[64];
+	Client *c;
+	int i;
+
+	unsetenv("HOME"); /* keeps saveapptagpersist() off the disk */
+	holdspeech = 1;   /* and notify_say() quiet */
+	backend = &fake;
+	sw = 1920;
+	sh = 1080;
+	scheme = ecalloc(2, sizeof(Clr *));
+	scheme[SchemeNorm] = scheme[SchemeSel] = ecalloc(3, sizeof(Clr));
+	mons = selmon = createmon();
+	selmon->mw = selmon->ww = sw;
+	selmon->mh = selmon->wh = sh;
+	compilerules();
+
+	clients = ecalloc(n, sizeof(Client *));
+	for (i = 0; i < n; i++) {
+		snprintf(class, sizeof class, "Lab-Application-%d", i % 20);
+		snprintf(instance, sizeof instance, "lab-application-%d", i % 20);
+		snprintf(title, sizeof title, "Document %d - Lab Application", i);
+		c = clients[i] = allocclient();
+		c->win = 0x1200001 + i;
+		c->mon = selmon;
+		c->bw = borderpx;
+		c->hintsvalid = 1;
+		c->cold->class = intern(class);
+		c->cold->instance = intern(instance);
+		c->cold->name = intern(title);
+		c->cold->classhash = persist_hash(class, strlen(class), instance, strlen(instance));
+		c->cold->hasclass = 1;
+		if (i % 20 == 7)
+			updateapptagpersist(class, instance, 2);
+		applyrules(c);
+		c->tags = 1; /* all start out visible */
+		attach(c);
+		attachstack(c);
+	}
+	focus(NULL);
+	arrange(selmon);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long n = 0;
+
+	if (argc < 3 || (nclients = atoi(argv[1])) < 8 || (n = atol(argv[2])) < 0)
+		die("usage: wm-bench clients ops (8 clients or more)");
+	setupfake(nclients);
+	check();
+	if (!n)
+		return EXIT_SUCCESS;
+
+	bench("applyrules", opapplyrules, n);
+	bench("persist", oppersist, n);
+	bench("focusstack", opfocusstack, n);
+	if (!selmon->sel || !ISVISIBLE(selmon->sel))
+		die("wm-bench: focusstack lost the selection");
+	bench("arrange", oparrange, n);
+	bench("view", opview, n);
+	view(&(Arg){ .ui = 3 });
+	bench("tag", optag, n);
+	if (!selmon->sel || !(selmon->sel->tags & 3))
+		die("wm-bench: tag lost the selection");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Replays a session trace written by "DINA -q trace /path" and reports, per
+ * event handler, how long it took and how many requests it sent, next to
+ * what the trace recorded:
+ *
+ *	xvfb-run -s '-screen 0 1920x1080x24' wm-replay session.trace
+ *	wm-replay -n session.trace
+ *
+ * The window management core runs in process against the X server in
+ * DISPLAY, which should be an otherwise empty Xvfb; a second connection
+ * plays the applications. Windows are created, retitled, reconfigured,
+ * unmapped and destroyed as recorded, and keys run what they are bound to
+ * in this build in the recorded order; quit and restart are skipped. Events no application can cause,
+ * like pointer crossings, are counted but not replayed. Records are replayed
+ * as fast as the server allows, so two runs on one machine compare. -n only
+ * reads the trace and reports what was recorded.
+ */
+#define main dina_main
+#include "../dwm.c"
+#undef main
+
+typedef struct {
+	unsigned long n, requests, recn, recrequests;
+	unsigned long long us, maxus, recus;
+} Stat;
+
+typedef struct {
+	Window traced, standin;
+} StandIn;
+
+static const char *eventnames[LASTEvent] = {
+	[KeyPress] = "KeyPress", [KeyRelease] = "KeyRelease",
+	[ButtonPress] = "ButtonPress", [ButtonRelease] = "ButtonRelease",
+	[MotionNotify] = "MotionNotify", [EnterNotify] = "EnterNotify",
+	[LeaveNotify] = "LeaveNotify", [FocusIn] = "FocusIn", [FocusOut] = "FocusOut",
+	[KeymapNotify] = "KeymapNotify", [Expose] = "Expose",
+	[GraphicsExpose] = "GraphicsExpose", [NoExpose] = "NoExpose",
+	[VisibilityNotify] = "VisibilityNotify", [CreateNotify] = "CreateNotify",
+	[DestroyNotify] = "DestroyNotify", [UnmapNotify] = "UnmapNotify",
+	[MapNotify] = "MapNotify", [MapRequest] = "MapRequest",
+	[ReparentNotify] = "ReparentNotify", [ConfigureNotify] = "ConfigureNotify",
+	[ConfigureRequest] = "ConfigureRequest", [GravityNotify] = "GravityNotify",
+	[ResizeRequest] = "ResizeRequest", [CirculateNotify] = "CirculateNotify",
+	[CirculateRequest] = "CirculateRequest", [PropertyNotify] = "PropertyNotify",
+	[SelectionClear] = "SelectionClear", [SelectionRequest] = "SelectionRequest",
+	[SelectionNotify] = "SelectionNotify", [ColormapNotify] = "ColormapNotify",
+	[ClientMessage] = "ClientMessage", [MappingNotify] = "MappingNotify",
+	[GenericEvent] = "GenericEvent",
+};
+static Stat stats[LASTEvent];
+static unsigned long skipped[LASTEvent];
+static Display *cdpy;            /* plays the applications */
+static Backend replay;           /* xlib without starting commands */
+static StandIn *standins;
+static size_t nstandins, standinscap;
+
+static pid_t
+nospawn(const char **argv)
+{
+	return 0;
+}
+
+static void
+account(int slot, unsigned long long start, unsigned long request)
+{
+	Stat *s = &stats[slot];
+	unsigned long long us = trace_now() - start;
+
+	s->n++;
+	s->us += us;
+	s->maxus = MAX(s->maxus, us);
+	s->requests += NextRequest(dpy) - request;
+}
+
+/* handles what the core's connection has queued, as run() would */
+static int
+pumpcore(void)
+{
+	unsigned long long start;
+	unsigned long request;
+	XEvent ev;
+	int n = 0;
+
+	XSync(dpy, False);
+	while (XPending(dpy)) {
+		XNextEvent(dpy, &ev);
+		start = trace_now();
+		request = NextRequest(dpy);
+		if (ev.type < LASTEvent && handler[ev.type])
+			handler[ev.type](&ev);
+		if (ev.type < LASTEvent)
+			account(ev.type, start, request);
+		n++;
+	}
+	return n;
+}
+
+static Window *
+standin(Window traced)
+{
+	size_t i;
+
+	for (i = 0; i < nstandins; i++)
+		if (standins[i].traced == traced)
+			return &standins[i].standin;
+	return NULL;
+}
+
+/* the applications close their windows when asked to */
+static int
+pumpclients(void)
+{
+	XEvent ev;
+	int n = 0;
+
+	XSync(cdpy, False);
+	while (XPending(cdpy)) {
+		XNextEvent(cdpy, &ev);
+		if (ev.type == ClientMessage && (Atom)ev.xclient.data.l[0] == wmatom[WMDelete])
+			XDestroyWindow(cdpy, ev.xclient.window);
+		n++;
+	}
+	return n;
+}
+
+static void
+pump(void)
+{
+	int i;
+
+	for (i = 0; i < 16 && (pumpclients() + pumpcore()); i++);
+}
+
+static void
+settitle(Window w, const char *title)
+{
+	XChangeProperty(cdpy, w, netatom[NetWMName], XInternAtom(cdpy, "UTF8_STRING", False),
+		8, PropModeReplace, (const unsigned char *)title, strlen(title));
+}
+
+static void
+createstandin(TracedWindow *t, const char *class)
+{
+	const char *instance = class + strlen(class) + 1;
+	const char *title = instance + strlen(instance) + 1;
+	XClassHint ch = { (char *)instance, (char *)class };
+	XSizeHints hints = { 0 };
+	Atom delete = wmatom[WMDelete];
+	Window w, *trans;
+
+	if (standin(t->window))
+		return;
+	w = XCreateSimpleWindow(cdpy, DefaultRootWindow(cdpy), t->x, t->y,
+		MAX(t->w, 1), MAX(t->h, 1), 0, 0, 0);
+	XSetClassHint(cdpy, w, &ch);
+	XSetWMProtocols(cdpy, w, &delete, 1);
+	settitle(w, title);
+	if (t->transient && (trans = standin(t->transient)))
+		XSetTransientForHint(cdpy, w, *trans);
+	if (t->fixed) {
+		hints.flags = PMinSize | PMaxSize;
+		hints.min_width = hints.max_width = t->w;
+		hints.min_height = hints.max_height = t->h;
+		XSetWMNormalHints(cdpy, w, &hints);
+	}
+	if (t->dialog)
+		XChangeProperty(cdpy, w, netatom[NetWMWindowType], XA_ATOM, 32, PropModeReplace,
+			(unsigned char *)&netatom[NetWMWindowTypeDialog], 1);
+	if (nstandins == standinscap) {
+		standinscap = standinscap ? standinscap * 2 : 64;
+		if (!(standins = realloc(standins, standinscap * sizeof(StandIn))))
+			die("realloc:");
+	}
+	standins[nstandins].traced = t->window;
+	standins[nstandins++].standin = w;
+	XMapWindow(cdpy, w);
+}
+
+/* keeps the recorded timings; returns whether the event is replayed */
+static int
+recorded(TracedEvent *t)
+{
+	Stat *s;
+
+	if (t->type >= LASTEvent)
+		return 0;
+	s = &stats[t->type];
+	s->recn++;
+	s->recus += t->us;
+	s->recrequests += t->requests;
+	switch (t->type) {
+	case ConfigureRequest:
+	case DestroyNotify:
+		return 1;
+	case UnmapNotify:
+		return !t->detail; /* the withdrawal, not our own unmap */
+	case KeyPress:    /* replayed through TraceKey */
+	case MapRequest:  /* and TraceWindow */
+		return 0;
+	case PropertyNotify:
+		if (t->detail == TracePropName)
+			return 0; /* and TraceTitle */
+		break;
+	}
+	skipped[t->type]++;
+	return 0;
+}
+
+static void
+replayevent(TracedEvent *t)
+{
+	XWindowChanges wc;
+	Window *w;
+
+	if (!(w = standin(t->window)))
+		return;
+	switch (t->type) {
+	case ConfigureRequest:
+		wc.x = t->x;
+		wc.y = t->y;
+		wc.width = MAX(t->w, 1);
+		wc.height = MAX(t->h, 1);
+		wc.border_width = t->bw;
+		XConfigureWindow(cdpy, *w, t->mask & (CWX|CWY|CWWidth|CWHeight|CWBorderWidth), &wc);
+		break;
+	case DestroyNotify:
+		XDestroyWindow(cdpy, *w);
+		*w = None;
+		break;
+	case UnmapNotify:
+		XUnmapWindow(cdpy, *w);
+		break;
+	}
+}
+
+/* runs what the key is bound to in this build, as keypress() would */
+static void
+replaykey(TracedKey *k)
+{
+	unsigned long long start;
+	unsigned long request;
+	unsigned int i;
+
+	start = trace_now();
+	request = NextRequest(dpy);
+	for (i = 0; i < LENGTH(keys); i++)
+		if (k->keysym == keys[i].keysym && CLEANMASK(k->mod) == CLEANMASK(keys[i].mod)
+		&& keys[i].func && keys[i].func != quit && keys[i].func != restart)
+			keys[i].func(&keys[i].arg);
+	account(KeyPress, start, request); /* the recorded time includes the binding */
+}
+
+static void
+report(int replayed)
+{
+	Stat *s;
+	int i;
+
+	printf("%-18s %7s %9s %9s %9s %9s %9s %8s\n", "handler", "events",
+		"us/event", "max us", "req/event", "rec n", "rec us", "rec req");
+	for (i = 0; i < LASTEvent; i++) {
+		s = &stats[i];
+		if (!s->n && !s->recn)
+			continue;
+		printf("%-18s %7lu ", eventnames[i] ? eventnames[i] : "?", s->n);
+		if (s->n)
+			printf("%9.1f %9llu %9.2f ", (double)s->us / s->n, s->maxus,
+				(double)s->requests / s->n);
+		else
+			printf("%9s %9s %9s ", "-", "-", "-");
+		if (s->recn)
+			printf("%9lu %9.1f %8.2f", s->recn, (double)s->recus / s->recn,
+				(double)s->recrequests / s->recn);
+		if (skipped[i] && replayed)
+			printf("  (%lu not replayed)", skipped[i]);
+		putchar('\n');
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static unsigned char payload[1 << 16];
+	char magic[sizeof TRACE_MAGIC - 1];
+	int nodisplay = 0, r;
+	TraceRecord rec;
+	TracedTitle *title;
+	Window *w;
+	FILE *f;
+
+	if (argc == 3 && !strcmp(argv[1], "-n"))
+		nodisplay = 1;
+	else if (argc != 2)
+		die("usage: wm-replay [-n] trace");
+	if (!(f = fopen(argv[argc - 1], "r")))
+		die("wm-replay: %s:", argv[argc - 1]);
+	if (fread(magic, 1, sizeof magic, f) != sizeof magic || memcmp(magic, TRACE_MAGIC, sizeof magic))
+		die("wm-replay: %s: not a DINA trace", argv[argc - 1]);
+
+	if (!nodisplay) {
+		unsetenv("HOME"); /* neither read nor write the user's layout */
+		if (!(dpy = XOpenDisplay(NULL)) || !(cdpy = XOpenDisplay(NULL)))
+			die("wm-replay: cannot open display");
+		xlib_init(dpy);
+		checkotherwm();
+		setup();
+		replay = xlib;
+		replay.spawn = nospawn;
+		backend = &replay;
+		holdspeech = 1;
+		pump();
+	}
+
+	while ((r = trace_read(f, &rec, payload, sizeof payload)) > 0) {
+		switch (rec.kind) {
+		case TraceEvent:
+			if (recorded((TracedEvent *)payload) && !nodisplay)
+				replayevent((TracedEvent *)payload);
+			break;
+		case TraceKey:
+			if (!nodisplay)
+				replaykey((TracedKey *)payload);
+			break;
+		case TraceWindow:
+			if (!nodisplay)
+				createstandin((TracedWindow *)payload, (char *)payload + sizeof(TracedWindow));
+			break;
+		case TraceTitle:
+			title = (TracedTitle *)payload;
+			if (!nodisplay && (w = standin(title->window)) && *w)
+				settitle(*w, (char *)payload + sizeof(TracedTitle));
+			break;
+		}
+		if (!nodisplay)
+			pump();
+	}
+	if (r < 0)
+		fprintf(stderr, "wm-replay: %s: trace cut short\n", argv[argc - 1]);
+	fclose(f);
+	report(!nodisplay);
+	return EXIT_SUCCESS;
+}
@@ -13,10 +13,90 @@ static const char *colors[][3]      = {
 	[SchemeSel]  = { col_black, col_black, col_black }, // Selected window
 };
 
+/* pressure stall handling (Linux PSI): a resource is under pressure when tasks
+ * stalled on it for psistall us within psiwindow us. Persistence writes and
+ * title refreshes wait until no trigger fired for psicalm ms. Kernels before
+ * 6.5 refuse unprivileged triggers; avg10 is then sampled against psiavg. */
+static const unsigned int psistall  = 200000;
+static const unsigned int psiwindow = 2000000; // Unprivileged triggers need a multiple of 2s
+static const unsigned int psicalm   = 5000;
+static const float psiavg           = 10.0;    // Percent, sampling fallback only
+/* speech stack processes (by comm name) whose I/O priority is raised under pressure */
+static const char *boostprocs[]     = { "orca", "speech-dispatch", "sd_espeak-ng", "sd_espeak", "sd_generic" };
+
+/* ConfigureRequests a window may send per second and in one burst; the rest
+ * wait, folded into one, and are applied once the window calms down */
+static const unsigned int cfgrate   = 60;
+static const unsigned int cfgburst  = 30;
+
+/* milliseconds a window gets to close before it is disconnected and its
+ * process terminated, and again before the process is killed */
+static const unsigned int killtimeout = 3000;
+
+/* logout, poweroff and reboot ask every window to close at once and give them
+ * shutdowntimeout milliseconds together; the ones left are announced and
+ * closed as above before DINA exits, for poweroff and reboot into these */
+static const unsigned int shutdowntimeout = 5000;
+static const char *poweroffcmd[] = { "systemctl", "poweroff", NULL };
+static const char *rebootcmd[]   = { "systemctl", "reboot", NULL };
+
+/* the focused window is pinged every pinginterval milliseconds and announced
+ * as not responding when it takes longer than pingtimeout to answer */
+static const unsigned int pinginterval = 5000;
+static const unsigned int pingtimeout  = 5000;
+
+/* blackout also shrinks the framebuffer to the smallest size RandR allows
+ * while every output is off */
+static const int blackoutlowpower = 1;
+
+/* The session boot: helper daemons DINA starts, watches and restarts when
+ * they die. Each starts as soon as the helper named in after is ready, all
+ * without one at once. A helper is ready once started (ReadyStarted), once
+ * speech-dispatcher answers on its socket (ReadySpeech) or once it reports
+ * "ready name" on the control socket (ReadyReported); after bootwait ms it
+ * counts as ready anyway. Announcements wait for the helpers marked hold.
+ * orcapath is the first start-orca found; helpers without a command are
+ * left out.
+ * A helper dying within helperstable ms of its start is restarted after
+ * helperbackoff ms, doubled for each such death in a row up to
+ * helperbackoffmax, and given up after helpertries of them. Crashes of the
+ * ReadySpeech helper are announced through speakcmd instead. */
+static const Helper helpers[] = {
+	/* name       after      ready           hold  command */
+	{ "speech",   NULL,      ReadySpeech,    1,    (const char*[]){ "speech-dispatcher", "--run-single", "--timeout", "0", NULL } },
+	{ "orca",     "speech",  ReadyReported,  1,    (const char*[]){ orcapath, "--foreground", "--wait", NULL } },
+	{ "sxhkd",    NULL,      ReadyStarted,   0,    (const char*[]){ "sxhkd", NULL } },
+	{ "battery",  NULL,      ReadyStarted,   0,    (const char*[]){ "/bin/sh", "-c", "exec \"$HOME/.local/bin/battery-watch\"", NULL } },
+};
+static const unsigned int bootwait         = 15000;
+static const unsigned int helperstable     = 10000;
+static const unsigned int helperbackoff    = 500;
+static const unsigned int helperbackoffmax = 30000;
+static const unsigned int helpertries      = 5;
+static const char *speakcmd[]              = { "espeak-ng", "-s", "160", "--", NULL }; // text is appended
+
+/* announcements go to the first voice that works: speech-dispatcher,
+ * espeak-ng in process (ESPEAK in config.mk), spd-say unless a ReadySpeech
+ * helper is supervised, as it would start a second speech-dispatcher, and
+ * last speakcmd. When
+ * speech-dispatcher does not answer within speechtimeout ms it is skipped
+ * for speechretry ms and the next voice repeats the message. During
+ * the boot "DINA window manager started" waits at most speechbudget ms for
+ * speech-dispatcher before another voice says it. */
+static const unsigned int speechbudget  = 1500;
+static const unsigned int speechtimeout = 1000;
+static const unsigned int speechretry   = 10000;
+
 /* tags (virtual workspaces) */
 static const char *tags[] = { "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
-/* no window rules */
+/* no window rules
+ * class, instance and title match as a substring by default, "=text" only
+ * matches exactly and "~regex" is a POSIX extended regular expression.
+ * Rules with a title are applied again whenever the window's title changes;
+ * once none matches, the window goes back to the tags and floating state it
+ * had without them.
+ */
 static const Rule rules[] = { 
 	/* class      instance    title       tags mask     isfloating   monitor */
 	{ NULL,       NULL,       NULL,       0,            0,           -1 }
@@ -45,11 +125,19 @@ static const Layout layouts[] = {
 static char dmenumon[2] = "0";
 static const char *dmenucmd[] = { "true", NULL };
 
+/* resident app launcher: started hidden with DINA and shown by Super+a; its
+ * windows (WM_CLASS instance launcherinstance) skip rules and persistence */
+static const char *launchercmd[]     = { "/bin/sh", "-c", "exec \"$HOME/.local/bin/app-launcher\" --daemon", NULL };
+static const char *launchershowcmd[] = { "/bin/sh", "-c", "exec \"$HOME/.local/bin/app-launcher\" --daemon --show", NULL };
+static const char launcherinstance[] = "dina-launcher";
+
 /* key bindings — minimal, accessible */
 static const Key keys[] = {
 	{ MODKEY,                       XK_j,      focusstack,     {.i = -1 } }, // Focus previous
 	{ MODKEY,                       XK_l,      focusstack,     {.i = +1 } }, // Focus next
 	{ MODKEY,                       XK_k,      killclient,     {0} },        // Close window
+	{ MODKEY,                       XK_a,      launcher,       {0} },        // Application menu
+	{ MODKEY,                       XK_b,      blackout,       {0} },        // Toggle screen blackout
 	/* Focus window by index (F1-F12) */
 	{ MODKEY,                       XK_F1,     focuswindowbyindex, {.i = 0} },
 	{ MODKEY,                       XK_F2,     focuswindowbyindex, {.i = 1} },
@@ -82,6 +170,7 @@ static const Key keys[] = {
 	{ MODKEY|ShiftMask,             XK_8,      tag,            {.ui = 1 << 7} },
 	{ MODKEY,                       XK_9,      view,           {.ui = 1 << 8} },
 	{ MODKEY|ShiftMask,             XK_9,      tag,            {.ui = 1 << 8} },
+	{ MODKEY|ShiftMask,             XK_r,      restart,        {0} },        // Restart DINA in place
 	{ MODKEY|ShiftMask,             XK_q,      quit,           {0} }         // Quit DINA
 };
 
@@ -20,15 +20,26 @@
  *
  * To understand everything else, start reading main().
  */
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
@@ -39,10 +50,19 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
 #include <X11/Xft/Xft.h>
 #include <sys/stat.h>
 
+#include "backend.h"
 #include "drw.h"
+#include "flight.h"
+#include "match.h"
+#include "persist.h"
+#include "speech.h"
+#include "trace.h"
 #include "util.h"
 
 /* macros */
@@ -58,16 +78,39 @@
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
 #define SHCMD_NOTIFY(cmd)      { .v = (const char*[]){ "/bin/sh", "-c", cmd, NULL } }
 #define APP_PERSIST_FILE        ".config/dina/workspace_layout"
+#define BOOT_LOG_FILE           ".local/share/DINA/boot.log"
+#define FLIGHT_LOG_FILE         ".local/share/DINA/flight.log"
+#define BOOTPROBE               20 /* ms between ReadySpeech attempts */
+#define PSI_DIR                 "/proc/pressure"
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_PRIO_VALUE(C, D) (((C) << 13) | (D))
+#define MONSTATE                9 /* longs per monitor in the root _DINA_STATE */
+#define CLIENTSTATE             9 /* longs in a client's _DINA_STATE */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open          434 /* Linux 5.3, older headers lack it */
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal   424 /* Linux 5.1 */
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD                 3   /* waitid() on a pidfd, Linux 5.4 */
+#endif
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; /* cursor */
 enum { SchemeNorm, SchemeSel }; /* color schemes */
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMWindowTypeDialog, NetClientList, NetWMPid, NetWMPing, NetLast }; /* EWMH atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { PsiCpu, PsiMemory, PsiIO, PsiLast }; /* pressure stall resources */
+enum { DeferPersist = 1 << 0, DeferTitles = 1 << 1 }; /* deferred work */
+enum { StartMain, StartSetup, StartSpeech, StartScan, StartReader, StartLast }; /* startup phases */
+enum { ShutdownNone, ShutdownLogout, ShutdownPoweroff, ShutdownReboot }; /* logout() */
+enum { ReadyStarted, ReadySpeech, ReadyReported }; /* when a helper counts as up */
+enum { CfgRequests, CfgCoalesced, CfgUnchanged, CfgLimited, CfgLast }; /* ConfigureRequest counters */
 
 typedef union {
 	int i;
@@ -86,19 +129,63 @@ typedef struct {
 
 typedef struct Monitor Monitor;
 typedef struct Client Client;
-struct Client {
-	char name[256];
+typedef struct {
+	const char *name;     /* interned, see intern() */
+	const char *class, *instance; /* interned WM_CLASS, see updateclass() */
+	int hasclass;                 /* 0 when WM_CLASS is missing, class is "broken" then */
+	unsigned int classhash;       /* persist_hash() of class and instance */
+	int titlerule;                /* 1 + title rule last applied, 0 for none */
+	unsigned int basetags;        /* tags and floating without the title rule, */
+	int basefloating;             /* restored when it stops matching */
+	unsigned int cfgkey;          /* last answered request and geometry, see configurerequest() */
+	long long cfgtat;             /* rate limiter: when the next request is due */
+	XConfigureRequestEvent cfgpending; /* held back by it, value_mask 0 for none */
+	long long pingat;             /* when the unanswered _NET_WM_PING was sent, or 0 */
+	unsigned int pinglast, pingmax; /* round trip in ms */
+	unsigned long pingsum, pings, pingtimeouts;
 	float mina, maxa;
-	int x, y, w, h;
 	int oldx, oldy, oldw, oldh;
-	int basew, baseh, incw, inch, maxw, maxh, minw, minh, hintsvalid;
-	int bw, oldbw;
-	unsigned int tags;
-	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen;
+	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
+	int oldbw, oldstate;
+	unsigned int order, stackorder; /* list positions kept across restart() */
+} ClientCold;
+
+/* Only what list walks, focus and arrange look at lives here, so a walk
+ * touches one cache line per client (checked below); the rest is in the
+ * cold record. */
+struct Client {
 	Client *next;
 	Client *snext;
 	Monitor *mon;
 	Window win;
+	unsigned int tags;
+	unsigned int isfixed : 1, isfloating : 1, isurgent : 1, neverfocus : 1,
+	             isfullscreen : 1, hintsvalid : 1, titledirty : 1,
+	             titlewatch : 1, /* title rules may apply, see applytitlerules() */
+	             closing : 1,    /* asked to close, see killclient() */
+	             hung : 1,       /* missed a _NET_WM_PING, see pingcheck() */
+	             bw : 16;        /* a CARD16 on the wire */
+	int x, y, w, h;
+	ClientCold *cold;
+};
+/* sizeof(Client) <= 64, a cache line; C99 has no _Static_assert */
+typedef char clientfitsline[sizeof(Client) <= 64 ? 1 : -1];
+
+/* clients are carved out of slabs, hot and cold records side by side */
+#define SLABCLIENTS 64
+typedef struct Slab Slab;
+struct Slab {
+	Slab *next;
+	Client hot[SLABCLIENTS];
+	ClientCold cold[SLABCLIENTS];
+};
+
+typedef struct Str Str;
+struct Str {
+	Str *next;
+	unsigned int hash;
+	unsigned int refs;
+	char s[];
 };
 
 typedef struct {
@@ -126,9 +213,11 @@ struct Monitor {
 	unsigned int tagset[2];
 	int showbar;
 	int topbar;
+	int dirty;            /* geometry or clients changed in updategeom() */
 	Client *clients;
 	Client *sel;
 	Client *stack;
+	Client *tagsel[32];   /* last selected client per tag, see view() */
 	Monitor *next;
 	Window barwin;
 	const Layout *lt[2];
@@ -143,22 +232,108 @@ typedef struct {
 	int monitor;
 } Rule;
 
+typedef struct {
+	int x, y, w, h;
+} MonGeom;
+
+typedef struct {
+	int fd;
+	short events;
+	void (*func)(int fd, short revents);
+} Watch;
+
+typedef struct {
+	long long when;             /* CLOCK_MONOTONIC, milliseconds */
+	void (*func)(unsigned long data);
+	unsigned long data;
+} Timer;
+
+typedef struct {
+	const char *name;
+	void (*func)(FILE *out, const char *args);
+} Command;
+
+typedef struct {
+	char rate[8];
+	char *text;
+} HeldSpeech;
+
+typedef struct {
+	const char *name;
+	int (*say)(const char *rate, const char *text); /* 0 once queued, else -1 */
+	long long downuntil;        /* monotime() before which it is skipped */
+	unsigned long spoken, failed;
+} Voice;
+
+typedef struct {
+	const char *name;
+	const char *after;          /* started once this helper is ready */
+	int ready;                  /* Ready*, see helperready() */
+	int hold;                   /* announcements wait until it is ready */
+	const char **cmd;
+} Helper;
+
+typedef struct {
+	const Helper *helper;
+	pid_t pid;                  /* 0 while stopped */
+	int pidfd;
+	long long started;          /* monotime() of the last start */
+	unsigned int restarts;
+	unsigned int fails;         /* quick deaths in a row, see helperexit() */
+	int stable;                 /* ran for helperstable ms at least once */
+	int gaveup;
+	int external;               /* was already running, left alone */
+	long long booted, readyat;  /* monotime() of the first start and readiness */
+	const char *readyhow;
+} Supervised;
+
+#ifdef XRANDR
+typedef struct {
+	RRCrtc crtc;
+	XRRCrtcInfo *info;
+} SavedCrtc;
+#endif /* XRANDR */
+
 /* function declarations */
+static void addwatch(int fd, short events, void (*func)(int fd, short revents));
+static Client *allocclient(void);
 static void applyrules(Client *c);
+static void applytitlerules(Client *c);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachstack(Client *c);
+static void blackout(const Arg *arg);
+static void boostspeech(void);
+static void bootdone(unsigned long data);
+static double bootms(long long t);
+static void bootstep(void);
 static void buttonpress(XEvent *e);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
+static void compilerules(void);
 static void clientmessage(XEvent *e);
+static void cmdblackout(FILE *out, const char *args);
+static void cmdflight(FILE *out, const char *args);
+static void cmdlogout(FILE *out, const char *args);
+static void cmdready(FILE *out, const char *args);
+static void cmdrestart(FILE *out, const char *args);
+static void cmdsay(FILE *out, const char *args);
+static void cmdstats(FILE *out, const char *args);
+static void cmdtrace(FILE *out, const char *args);
 static void configure(Client *c);
+static void configureclient(Client *c, XConfigureRequestEvent *ev);
+static void configurefold(XConfigureRequestEvent *ev, const XConfigureRequestEvent *n);
+static void configurelater(unsigned long w);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
+static void ctlaccept(int fd, short revents);
+static void crash(int sig);
 static Monitor *createmon(void);
+static void defer(unsigned int work);
+static void delwatch(int fd);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
@@ -166,41 +341,82 @@ static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
 static void drawbars(void);
 static void enternotify(XEvent *e);
+#ifdef ESPEAK
+static int espeaksay(const char *rate, const char *text);
+#endif
 static void expose(XEvent *e);
+static int findorca(char *buf, size_t len);
+static void flushdeferred(void);
 static void focus(Client *c);
+static void forgetsel(Monitor *m, Client *c, unsigned int tags);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
 static void focuswindowbyindex(const Arg *arg);
+static void freeclient(Client *c);
 static Atom getatomprop(Client *c, Atom prop);
+static pid_t getlocalpid(Window w);
+static Cursor getcursor(int cur);
+static int getmongeoms(MonGeom **geoms);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
+static void helperannounce(Supervised *s, const char *text);
+static void helperexit(int fd, short revents);
+static void helperprobe(unsigned long i);
+static void helperready(Supervised *s, const char *how);
+static void helperstart(unsigned long i);
+static void helpertimeout(unsigned long i);
 static void incnmaster(const Arg *arg);
+static const char *intern(const char *s);
+static int isuniquegeom(MonGeom *unique, size_t n, MonGeom *info);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
+static void launcher(const Arg *arg);
+static void killescalate(unsigned long w);
+static void killpid(unsigned long fd);
+static void logout(const Arg *arg);
 static void manage(Window w, XWindowAttributes *wa);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
+static long long monotime(void);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
-static void notify_tag(int tag);
+static void notify_say(const char *rate, const char *text);
+static void notify_tag(int tag, const char *title);
 static void notify_window_move(int from_tag, int to_tag);
 static void notify_window_untracked(const char *class, const char *instance);
 static void notify_startup(void);
+static void notify_started(unsigned long data);
 static Client *nexttiled(Client *c);
+static void pingcheck(unsigned long w);
+static void pingsel(unsigned long data);
+static void pong(Client *c);
 static void pop(Client *c);
 static void propertynotify(XEvent *e);
+static void psievent(int fd, short revents);
+static void psipoll(unsigned long data);
+static void psirelax(unsigned long r);
+static void psisetup(void);
+static void psitrigger(int r);
 static void quit(const Arg *arg);
+static int query(int argc, char *argv[]);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
+static void releasespeech(unsigned long timedout);
+static void restart(const Arg *arg);
+static int restoreclient(Client *c);
+static void restoremons(void);
+static void restorestacks(void);
 static void run(void);
+static void runtimers(void);
+static void savestate(void);
 static void scan(void);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
@@ -209,10 +425,28 @@ static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void settimer(long ms, void (*func)(unsigned long), unsigned long data);
+static int setblackout(int off);
 static void setup(void);
+static void setupctl(void);
 static void seturgent(Client *c, int urg);
 static void showhide(Client *c);
+static void shutdownstep(unsigned long stage);
+static void startsession(void);
+static void startupmark(int phase);
+static double startupms(int phase);
+static void sockpath(char *buf, size_t len, const char *name);
 static void spawn(const Arg *arg);
+static void speak(const char *rate, const char *text);
+static void speechcheck(unsigned long data);
+static void speechclose(void);
+static void speechevent(int fd, short revents);
+static int spdsay(const char *rate, const char *text);
+static int speakcmdsay(const char *rate, const char *text);
+static int ssipsay(const char *rate, const char *text);
+static Supervised *supervise(const Helper *h, pid_t adopt);
+static void supervisecleanup(void);
+static void supervisesetup(void);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
 static void tile(Monitor *m);
@@ -220,10 +454,16 @@ static void togglebar(const Arg *arg);
 static void togglefloating(const Arg *arg);
 static void toggletag(const Arg *arg);
 static void toggleview(const Arg *arg);
+static void traceclients(void);
+static void traceevent(XEvent *e, unsigned long long start, unsigned long request);
+static void tracetitle(Client *c);
+static void tracewindow(Client *c, Window trans);
+static void unintern(const char *s);
 static void unfocus(Client *c, int setfocus);
 static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
+static void updateclass(Client *c);
 static void updatebars(void);
 static void updateclientlist(void);
 static int updategeom(void);
@@ -231,6 +471,7 @@ static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
 static void updatestatus(void);
 static void updatetitle(Client *c);
+static void updatetopology(unsigned long data);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
@@ -245,16 +486,9 @@ static void zoom(const Arg *arg);
 static void loadapptagpersist(void);
 static void saveapptagpersist(void);
 static void updateapptagpersist(const char *class, const char *instance, int tag);
-static int findapptagpersist(const char *class, const char *instance);
+static int findapptagpersist(const char *class, const char *instance, unsigned int hash);
 static void notifytagplacement(const char *class, const char *instance, int tag);
 
-/* App persistence structure */
-typedef struct {
-	char class[256];   /* application class (WM_CLASS) */
-	char instance[256]; /* application instance (WM_CLASS) */
-	int tag;           /* tag number (1-9) */
-} AppPersist;
-
 /* variables */
 static const char broken[] = "broken";
 static char stext[256];
@@ -264,8 +498,39 @@ static int bh;               /* bar height */
 static int lrpad;            /* sum of left and right padding for text */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
-static AppPersist *app_persists = NULL;  /* Dynamic array of app persistence entries */
-static int n_app_persists = 0;           /* Number of entries in app_persists */
+static Persist layout;                   /* app persistence entries, see persist.c */
+static Matcher *matcher;                 /* rules[], see compilerules() */
+static unsigned long cfgstats[CfgLast];
+static Watch watches[16];                /* file descriptors polled by run() */
+static int nwatches = 0;
+static Timer *timers = NULL;             /* pending one-shot timers, unordered */
+static size_t ntimers = 0, timerscap = 0;
+static int ctlfd = -1;                   /* control socket, see query() */
+static int speechfd = -1;                /* speech-dispatcher, see notify_say() */
+static long long speechsent = 0;         /* monotime() of the oldest unanswered message */
+static HeldSpeech speechlast;            /* spoken again by the next voice, see speechcheck() */
+static int holdspeech = 0;               /* announcements wait for the boot, see helperready() */
+static HeldSpeech heldspeech[16];
+static int nheldspeech = 0;
+static Supervised supervised[8];         /* helper daemons, see supervise() */
+static int nsupervised = 0;
+static int booting = 0;                  /* helpers starting up, see helperready() */
+static char orcapath[PATH_MAX];          /* start-orca, see findorca() */
+static const char *psinames[PsiLast] = { "cpu", "memory", "io" };
+static int psifd[PsiLast] = { -1, -1, -1 };
+static const char *psimode = "unavailable";
+static unsigned int pressured = 0;       /* bitmask of resources under pressure */
+static unsigned long psicount[PsiLast];
+static unsigned int boosted = 0;
+static unsigned int deferred = 0;        /* Defer* work postponed under pressure */
+static int blackedout = 0;               /* outputs switched off by blackout() */
+#ifdef XRANDR
+static int rrevbase = 0;                 /* nonzero while RandR 1.5 monitors are used */
+static int rrversion = 0;                /* RandR major * 100 + minor, 0 if missing */
+static SavedCrtc *blackcrtcs = NULL;     /* CRTCs to restore after a blackout */
+static int nblackcrtcs = 0;
+static int blackw, blackh, blackmmw, blackmmh; /* screen size before a blackout */
+#endif /* XRANDR */
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
 	[ClientMessage] = clientmessage,
@@ -282,11 +547,65 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 };
+static const Command commands[] = {
+	{ "blackout",   cmdblackout },
+	{ "flight",     cmdflight },
+	{ "logout",     cmdlogout },
+	{ "ready",      cmdready },
+	{ "restart",    cmdrestart },
+	{ "say",        cmdsay },
+	{ "stats",      cmdstats },
+	{ "trace",      cmdtrace },
+};
+/* tried in this order by speak() */
+static Voice voices[] = {
+	{ "speech-dispatcher", ssipsay },
+#ifdef ESPEAK
+	{ "espeak-ng",         espeaksay },
+#endif
+	{ "spd-say",           spdsay },
+	{ "speakcmd",          speakcmdsay },
+};
+static char *wmatomnames[WMLast] = {
+	[WMProtocols] = "WM_PROTOCOLS",
+	[WMDelete] = "WM_DELETE_WINDOW",
+	[WMState] = "WM_STATE",
+	[WMTakeFocus] = "WM_TAKE_FOCUS",
+};
+static char *netatomnames[NetLast] = {
+	[NetSupported] = "_NET_SUPPORTED",
+	[NetWMName] = "_NET_WM_NAME",
+	[NetWMState] = "_NET_WM_STATE",
+	[NetWMCheck] = "_NET_SUPPORTING_WM_CHECK",
+	[NetWMFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+	[NetActiveWindow] = "_NET_ACTIVE_WINDOW",
+	[NetWMWindowType] = "_NET_WM_WINDOW_TYPE",
+	[NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+	[NetClientList] = "_NET_CLIENT_LIST",
+	[NetWMPid] = "_NET_WM_PID",
+	[NetWMPing] = "_NET_WM_PING",
+};
+static const int cursorshape[CurLast] = {
+	[CurNormal] = XC_left_ptr,
+	[CurResize] = XC_sizing,
+	[CurMove] = XC_fleur,
+};
 static Atom wmatom[WMLast], netatom[NetLast];
 static int running = 1;
-static Cur *cursor[CurLast];
+static int restarting;       /* exec ourselves once run() returns */
+static int restoring;        /* started by restart(), see savestate() */
+static int shuttingdown;     /* Shutdown* under way, see logout() */
+static int tracing;          /* a session trace is written, see cmdtrace() */
+static Atom stateatom;       /* _DINA_STATE */
+static struct timespec startup[StartLast];
+static const char *startnames[StartLast] = { "main", "setup", "speech", "scan", "reader" };
+static Cur *cursor[CurLast];                /* created on first use, see getcursor() */
+static Slab *slabs;
+static Client *freeclients;                 /* free slab slots, linked through next */
+static Str *strtab[256];                    /* interned strings */
 static Clr **scheme;
 static Display *dpy;
+static const Backend *backend = &xlib; /* requests of the core, see backend.h */
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
@@ -298,6 +617,46 @@ static Window root, wmcheckwin;
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
+void
+addwatch(int fd, short events, void (*func)(int fd, short revents))
+{
+	if (fd < 0)
+		return;
+	if (nwatches == LENGTH(watches))
+		die("DINA: too many watched file descriptors");
+	watches[nwatches].fd = fd;
+	watches[nwatches].events = events;
+	watches[nwatches].func = func;
+	nwatches++;
+}
+
+Client *
+allocclient(void)
+{
+	Client *c;
+	ClientCold *cold;
+	Slab *s;
+	int i;
+
+	if (!freeclients) {
+		s = ecalloc(1, sizeof(Slab));
+		s->next = slabs;
+		slabs = s;
+		for (i = SLABCLIENTS - 1; i >= 0; i--) {
+			s->hot[i].cold = &s->cold[i];
+			s->hot[i].next = freeclients;
+			freeclients = &s->hot[i];
+		}
+	}
+	c = freeclients;
+	freeclients = c->next;
+	cold = c->cold;
+	memset(c, 0, sizeof(Client));
+	memset(cold, 0, sizeof(ClientCold));
+	c->cold = cold;
+	return c;
+}
+
 void
 applyrules(Client *c)
 {
@@ -305,48 +664,51 @@ applyrules(Client *c)
 	unsigned int i;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
 	int persist_idx;
 	int from_persistence = 0;
+	int hits[LENGTH(rules)], n;
+	unsigned int basetags = 0;
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
+	class    = c->cold->class;
+	instance = c->cold->instance;
 
-	/* First check for persistent tag assignments */
-	persist_idx = findapptagpersist(class, instance);
+	/* First check for persistent tag assignments; windows without
+	 * WM_CLASS would all share one entry */
+	persist_idx = c->cold->hasclass ? findapptagpersist(class, instance, c->cold->classhash) : -1;
 	if (persist_idx >= 0) {
-		c->tags = 1 << (app_persists[persist_idx].tag - 1);
+		c->tags = 1 << (layout.entries[persist_idx].tag - 1);
 		from_persistence = 1;
 	}
 
 	/* If no persistent assignment or it returned 0, apply standard rules */
 	if (!from_persistence || c->tags == 0) {
-		for (i = 0; i < LENGTH(rules); i++) {
-			r = &rules[i];
-			if ((!r->title || strstr(c->name, r->title))
-			&& (!r->class || strstr(class, r->class))
-			&& (!r->instance || strstr(instance, r->instance)))
-			{
-				c->isfloating = r->isfloating;
-				c->tags |= r->tags;
-				for (m = mons; m && m->num != r->monitor; m = m->next);
-				if (m)
-					c->mon = m;
+		n = match_rules(matcher, (const char *[]){ class, instance, c->cold->name }, 0, hits);
+		for (i = 0; i < n; i++) {
+			r = &rules[hits[i]];
+			c->isfloating = r->isfloating;
+			c->tags |= r->tags;
+			for (m = mons; m && m->num != r->monitor; m = m->next);
+			if (m)
+				c->mon = m;
+			if (match_uses(matcher, hits[i], MatchTitle))
+				c->cold->titlerule = hits[i] + 1;
+			else {
+				basetags |= r->tags;
+				c->cold->basefloating = r->isfloating;
 			}
 		}
+		/* watch the title if a title rule would match on class and instance */
+		n = match_rules(matcher, (const char *[]){ class, instance, NULL }, 1 << MatchTitle, hits);
+		for (i = 0; i < n && !c->titlewatch; i++)
+			c->titlewatch = match_uses(matcher, hits[i], MatchTitle);
 	}
 
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
-
 	/* Ensure window has tags, defaulting to current tag if none assigned */
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
+	c->cold->basetags = basetags & TAGMASK ? basetags & TAGMASK : c->mon->tagset[c->mon->seltags];
 
 	/* Notify user if we placed window based on persistence */
 	if (from_persistence && c->tags != (1 << 0)) {  /* Don't notify for tag 1 */
@@ -360,6 +722,52 @@ applyrules(Client *c)
 	}
 }
 
+/* a new title may select another title rule: apply its tags and floating
+ * state, the monitor stays where the window was managed */
+void
+applytitlerules(Client *c)
+{
+	const Rule *r;
+	int hits[LENGTH(rules)], i, n, rule = 0, old = c->cold->titlerule;
+	int wassel = c == c->mon->sel;
+	unsigned int newtags = c->tags;
+	int floating = c->isfloating;
+
+	n = match_rules(matcher, (const char *[]){ c->cold->class, c->cold->instance, c->cold->name },
+		0, hits);
+	for (i = 0; i < n; i++)
+		if (match_uses(matcher, hits[i], MatchTitle))
+			rule = hits[i] + 1;
+	if (rule == old)
+		return;
+	c->cold->titlerule = rule;
+	if (rule && !old) {
+		c->cold->basetags = c->tags;
+		c->cold->basefloating = c->isfloating;
+	}
+	if (rule) {
+		r = &rules[rule - 1];
+		if (r->tags & TAGMASK)
+			newtags = r->tags & TAGMASK;
+		floating = r->isfloating;
+	} else { /* back to where the class and instance rules put it */
+		r = &rules[old - 1];
+		if (r->tags & TAGMASK)
+			newtags = c->cold->basetags;
+		floating = c->cold->basefloating;
+	}
+	if (c->isfullscreen)
+		floating = c->isfloating;
+	if (newtags == c->tags && floating == c->isfloating)
+		return;
+	c->tags = newtags;
+	c->isfloating = floating;
+	forgetsel(c->mon, c, ~c->tags);
+	arrange(c->mon);
+	if (wassel && !ISVISIBLE(c))
+		focus(NULL);
+}
+
 int
 applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 {
@@ -396,34 +804,34 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 		if (!c->hintsvalid)
 			updatesizehints(c);
 		/* see last two sentences in ICCCM 4.1.2.3 */
-		baseismin = c->basew == c->minw && c->baseh == c->minh;
+		baseismin = c->cold->basew == c->cold->minw && c->cold->baseh == c->cold->minh;
 		if (!baseismin) { /* temporarily remove base dimensions */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= c->cold->basew;
+			*h -= c->cold->baseh;
 		}
 		/* adjust for aspect limits */
-		if (c->mina > 0 && c->maxa > 0) {
-			if (c->maxa < (float)*w / *h)
-				*w = *h * c->maxa + 0.5;
-			else if (c->mina < (float)*h / *w)
-				*h = *w * c->mina + 0.5;
+		if (c->cold->mina > 0 && c->cold->maxa > 0) {
+			if (c->cold->maxa < (float)*w / *h)
+				*w = *h * c->cold->maxa + 0.5;
+			else if (c->cold->mina < (float)*h / *w)
+				*h = *w * c->cold->mina + 0.5;
 		}
 		if (baseismin) { /* increment calculation requires this */
-			*w -= c->basew;
-			*h -= c->baseh;
+			*w -= c->cold->basew;
+			*h -= c->cold->baseh;
 		}
 		/* adjust for increment value */
-		if (c->incw)
-			*w -= *w % c->incw;
-		if (c->inch)
-			*h -= *h % c->inch;
+		if (c->cold->incw)
+			*w -= *w % c->cold->incw;
+		if (c->cold->inch)
+			*h -= *h % c->cold->inch;
 		/* restore base dimensions */
-		*w = MAX(*w + c->basew, c->minw);
-		*h = MAX(*h + c->baseh, c->minh);
-		if (c->maxw)
-			*w = MIN(*w, c->maxw);
-		if (c->maxh)
-			*h = MIN(*h, c->maxh);
+		*w = MAX(*w + c->cold->basew, c->cold->minw);
+		*h = MAX(*h + c->cold->baseh, c->cold->minh);
+		if (c->cold->maxw)
+			*w = MIN(*w, c->cold->maxw);
+		if (c->cold->maxh)
+			*h = MIN(*h, c->cold->maxh);
 	}
 	return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
 }
@@ -464,6 +872,129 @@ attachstack(Client *c)
 	c->mon->stack = c;
 }
 
+/* toggles the blackout, see setblackout(), with a tone for each way */
+void
+blackout(const Arg *arg)
+{
+	int was = blackedout, failed = setblackout(!blackedout);
+	Arg tone = { .v = (const char*[]){ "play", "-nq", "synth", "0.1", "sin",
+		blackedout ? "440" : "880", "vol", "0.4", NULL } };
+
+	spawn(&tone);
+	if (failed < 0)
+		notify_say("-40", "Screen blackout needs RandR");
+	else if (was == blackedout)
+		notify_say("-40", was ? "Screen restore failed" : "Screen blackout failed");
+	else if (failed)
+		notify_say("-40", blackedout ? "Screen blackout incomplete" : "Screen restore incomplete");
+	else
+		notify_say("-40", blackedout ? "Screen off" : "Screen on");
+}
+
+/* Raise the I/O priority of the speech stack to the top of the best-effort
+ * class so it keeps talking while the machine is thrashing. Unlike a
+ * negative nice value this needs no privileges for our own processes;
+ * processes of other users are left alone and not counted. */
+void
+boostspeech(void)
+{
+	DIR *d;
+	FILE *f;
+	struct dirent *de;
+	char path[64], comm[32];
+	pid_t pid;
+	size_t i;
+
+	if (!(d = opendir("/proc")))
+		return;
+	while ((de = readdir(d))) {
+		if ((pid = atoi(de->d_name)) <= 0)
+			continue;
+		snprintf(path, sizeof path, "/proc/%d/comm", (int)pid);
+		if (!(f = fopen(path, "r")))
+			continue;
+		if (fgets(comm, sizeof comm, f)) {
+			comm[strcspn(comm, "\n")] = '\0';
+			for (i = 0; i < LENGTH(boostprocs); i++) {
+				if (strcmp(comm, boostprocs[i]))
+					continue;
+#ifdef SYS_ioprio_set
+				if (syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, (int)pid,
+				    IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 0)) == 0)
+					boosted++;
+#endif /* SYS_ioprio_set */
+				break;
+			}
+		}
+		fclose(f);
+	}
+	closedir(d);
+}
+
+/* Logs when each helper was started and ready, in ms since main(), to
+ * stderr and as one line per boot to BOOT_LOG_FILE, for comparing boots
+ * across releases. */
+void
+bootdone(unsigned long data)
+{
+	char path[PATH_MAX], line[1024];
+	const char *home = getenv("HOME");
+	time_t now = time(NULL);
+	Supervised *s;
+	size_t n;
+	FILE *f;
+	int i;
+
+	booting = 0;
+	n = strftime(line, sizeof line, "%Y-%m-%dT%H:%M:%S DINA-" VERSION, localtime(&now));
+	for (i = StartSetup; i < StartLast && n < sizeof line; i++)
+		if (startupms(i) > 0)
+			n += snprintf(line + n, sizeof line - n, " %s=%.1f", startnames[i], startupms(i));
+	for (i = 0; i < nsupervised && n < sizeof line; i++) {
+		s = &supervised[i];
+		n += snprintf(line + n, sizeof line - n, " %s=%.1f/%.1f/%s", s->helper->name,
+			bootms(s->booted), bootms(s->readyat), s->readyhow);
+	}
+	fprintf(stderr, "DINA: boot: %s\n", line);
+	if (!home)
+		return;
+	snprintf(path, sizeof path, "%s/.local/share/DINA", home);
+	mkdir(path, 0755);
+	snprintf(path, sizeof path, "%s/%s", home, BOOT_LOG_FILE);
+	if ((f = fopen(path, "a"))) {
+		fprintf(f, "%s\n", line);
+		fclose(f);
+	}
+}
+
+/* milliseconds from entering main() to the monotime() t, 0 for never */
+double
+bootms(long long t)
+{
+	if (!t)
+		return 0;
+	return t - (startup[StartMain].tv_sec * 1e3 + startup[StartMain].tv_nsec / 1e6);
+}
+
+/* starts the helpers not started yet whose after helper is ready, is left
+ * out or is none */
+void
+bootstep(void)
+{
+	Supervised *s;
+	int i, j;
+
+	for (i = 0; i < nsupervised; i++) {
+		s = &supervised[i];
+		if (s->booted || s->gaveup)
+			continue;
+		for (j = 0; s->helper->after && j < nsupervised
+			&& strcmp(supervised[j].helper->name, s->helper->after); j++);
+		if (!s->helper->after || j == nsupervised || supervised[j].readyat)
+			helperstart(i);
+	}
+}
+
 void
 buttonpress(XEvent *e)
 {
@@ -523,9 +1054,11 @@ cleanup(void)
 	Arg a = {.ui = ~0};
 	Layout foo = { "", NULL };
 	Monitor *m;
-	size_t i;
+	Slab *s;
+	size_t i, j;
 
-	view(&a);
+	if (!restarting) /* reveal everything, unless restored right away */
+		view(&a);
 	selmon->lt[selmon->sellt] = &foo;
 	for (m = mons; m; m = m->next)
 		while (m->stack)
@@ -533,13 +1066,38 @@ cleanup(void)
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	while (mons)
 		cleanupmon(mons);
+	match_free(matcher);
+	for (; slabs; slabs = s) {
+		s = slabs->next;
+		free(slabs);
+	}
 	for (i = 0; i < CurLast; i++)
 		drw_cur_free(drw, cursor[i]);
-	for (i = 0; i < LENGTH(colors); i++)
-		free(scheme[i]);
+	for (i = 0; i < LENGTH(colors); i++) {
+		for (j = 0; j < i && scheme[j] != scheme[i]; j++);
+		if (j == i) /* schemes with identical colors are shared */
+			free(scheme[i]);
+	}
 	free(scheme);
 	XDestroyWindow(dpy, wmcheckwin);
 	drw_free(drw);
+	if (blackedout)
+		setblackout(0);
+	/* nothing may stay deferred past this point */
+	pressured = 0;
+	flushdeferred();
+	if (ctlfd >= 0) {
+		char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+
+		close(ctlfd);
+		sockpath(path, sizeof path, "dina");
+		unlink(path);
+	}
+	if (speechfd >= 0)
+		close(speechfd);
+	free(speechlast.text);
+	supervisecleanup();
+	free(timers);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
@@ -565,9 +1123,15 @@ void
 clientmessage(XEvent *e)
 {
 	XClientMessageEvent *cme = &e->xclient;
-	Client *c = wintoclient(cme->window);
+	Client *c;
 
-	if (!c)
+	if (cme->window == root && cme->message_type == wmatom[WMProtocols]
+	&& (Atom)cme->data.l[0] == netatom[NetWMPing]) {
+		if ((c = wintoclient(cme->data.l[2])))
+			pong(c);
+		return;
+	}
+	if (!(c = wintoclient(cme->window)))
 		return;
 	if (cme->message_type == netatom[NetWMState]) {
 		if (cme->data.l[1] == netatom[NetWMFullscreen]
@@ -580,6 +1144,186 @@ clientmessage(XEvent *e)
 	}
 }
 
+void
+cmdblackout(FILE *out, const char *args)
+{
+	blackout(NULL);
+	fprintf(out, "%s\n", blackedout ? "off" : "on");
+}
+
+/* writes the flight recorder out without crashing first */
+void
+cmdflight(FILE *out, const char *args)
+{
+	char path[PATH_MAX];
+	const char *home = getenv("HOME");
+
+	if (!home || flight_dump() < 0) {
+		fputs("error: cannot write the flight log\n", out);
+		return;
+	}
+	snprintf(path, sizeof path, "%s/%s", home, FLIGHT_LOG_FILE);
+	fprintf(out, "%s\n", path);
+}
+
+/* "logout", "logout poweroff" or "logout reboot", see logout() */
+void
+cmdlogout(FILE *out, const char *args)
+{
+	Arg a;
+
+	if (!*args)
+		a.i = ShutdownLogout;
+	else if (!strcmp(args, "poweroff"))
+		a.i = ShutdownPoweroff;
+	else if (!strcmp(args, "reboot"))
+		a.i = ShutdownReboot;
+	else {
+		fputs("error: usage: logout [poweroff|reboot]\n", out);
+		return;
+	}
+	logout(&a);
+	fputs("ok\n", out);
+}
+
+/* a ReadyReported helper reports itself up; start-orca just says "ready" */
+void
+cmdready(FILE *out, const char *args)
+{
+	const char *name = *args ? args : "orca";
+	int i;
+
+	for (i = 0; i < nsupervised && strcmp(supervised[i].helper->name, name); i++);
+	if (i == nsupervised) {
+		fprintf(out, "error: no helper %s\n", name);
+		return;
+	}
+	if (!strcmp(name, "orca") && !startup[StartReader].tv_sec && !startup[StartReader].tv_nsec)
+		startupmark(StartReader);
+	helperready(&supervised[i], "reported");
+	fputs("ok\n", out);
+}
+
+void
+cmdrestart(FILE *out, const char *args)
+{
+	fputs("restarting\n", out);
+	restart(NULL);
+}
+
+/* speaks args through the shared connection, for helpers like battery-watch */
+void
+cmdsay(FILE *out, const char *args)
+{
+	if (!*args) {
+		fputs("error: usage: say text\n", out);
+		return;
+	}
+	notify_say("-40", args);
+	fputs("ok\n", out);
+}
+
+void
+cmdstats(FILE *out, const char *args)
+{
+	char path[64], line[128];
+	FILE *f;
+	Client *c;
+	Monitor *m;
+	Supervised *s;
+	int r;
+
+	for (r = StartSetup; r < StartLast; r++)
+		if (startupms(r) > 0)
+			fprintf(out, "startup.%s: %.1f ms\n", startnames[r], startupms(r));
+		else
+			fprintf(out, "startup.%s: pending\n", startnames[r]);
+	fprintf(out, "pressure.mode: %s\n", psimode);
+	for (r = 0; r < PsiLast; r++) {
+		fprintf(out, "pressure.%s: %s, %lu triggers", psinames[r],
+			pressured & 1 << r ? "high" : "normal", psicount[r]);
+		snprintf(path, sizeof path, PSI_DIR "/%s", psinames[r]);
+		if ((f = fopen(path, "r"))) {
+			if (fgets(line, sizeof line, f))
+				fprintf(out, ", %s", line);
+			fclose(f);
+		} else
+			fputc('\n', out);
+	}
+	fprintf(out, "pressure.boosted: %u\n", boosted);
+	fprintf(out, "deferred:%s%s\n", deferred & DeferPersist ? " persist" : "",
+		deferred & DeferTitles ? " titles" : "");
+	for (r = 0; r < LENGTH(voices); r++)
+		fprintf(out, "speech.%s: %lu spoken, %lu failed%s\n", voices[r].name,
+			voices[r].spoken, voices[r].failed,
+			voices[r].downuntil > monotime() ? ", skipped" : "");
+	fprintf(out, "configure: %lu requests, %lu coalesced, %lu unchanged, %lu rate limited\n",
+		cfgstats[CfgRequests], cfgstats[CfgCoalesced], cfgstats[CfgUnchanged],
+		cfgstats[CfgLimited]);
+	for (r = 0; r < nsupervised; r++) {
+		s = &supervised[r];
+		if (s->pid)
+			fprintf(out, "helper.%s: running, pid %d, up %lld s, %u restarts\n", s->helper->name,
+				(int)s->pid, (monotime() - s->started) / 1000, s->restarts);
+		else
+			fprintf(out, "helper.%s: %s, %u restarts\n", s->helper->name,
+				s->external ? "already running, not supervised" : s->gaveup ? "given up"
+				: s->booted ? "restarting" : "waiting", s->restarts);
+		if (s->readyat)
+			fprintf(out, "boot.%s: started %.1f ms, ready %.1f ms, %s\n", s->helper->name,
+				bootms(s->booted), bootms(s->readyat), s->readyhow);
+		else
+			fprintf(out, "boot.%s: pending\n", s->helper->name);
+	}
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->cold->pings || c->cold->pingtimeouts)
+				fprintf(out, "ping.%s.0x%lx: last %u ms, max %u ms, mean %lu ms, "
+					"%lu pings, %lu timeouts%s\n", c->cold->class, c->win,
+					c->cold->pinglast, c->cold->pingmax,
+					c->cold->pings ? c->cold->pingsum / c->cold->pings : 0,
+					c->cold->pings, c->cold->pingtimeouts, c->hung ? ", not responding" : "");
+}
+
+void
+compilerules(void)
+{
+	unsigned int i;
+
+	matcher = match_create(LENGTH(rules));
+	for (i = 0; i < LENGTH(rules); i++) {
+		match_add(matcher, i, MatchClass, rules[i].class);
+		match_add(matcher, i, MatchInstance, rules[i].instance);
+		match_add(matcher, i, MatchTitle, rules[i].title);
+	}
+	match_build(matcher);
+}
+
+/* "trace /path" starts writing a session trace for bench/wm-replay,
+ * "trace off" ends it */
+void
+cmdtrace(FILE *out, const char *args)
+{
+	int raw = !strncmp(args, "-raw ", 5);
+
+	if (raw)
+		args += 5;
+	if (!strcmp(args, "off") && !raw) {
+		trace_close();
+		tracing = 0;
+	} else if (*args != '/') {
+		fputs("error: usage: trace [-raw] /path|off\n", out);
+		return;
+	} else if (trace_open(args, raw) < 0) {
+		fprintf(out, "error: %s: %s\n", args, strerror(errno));
+		return;
+	} else {
+		tracing = 1;
+		traceclients();
+	}
+	fputs("ok\n", out);
+}
+
 void
 configure(Client *c)
 {
@@ -596,34 +1340,129 @@ configure(Client *c)
 	ce.border_width = c->bw;
 	ce.above = None;
 	ce.override_redirect = False;
-	XSendEvent(dpy, c->win, False, StructureNotifyMask, (XEvent *)&ce);
+	backend->send(c->win, StructureNotifyMask, (XEvent *)&ce);
 }
 
+/* applies a ConfigureRequest from a managed window */
 void
-configurenotify(XEvent *e)
+configureclient(Client *c, XConfigureRequestEvent *ev)
 {
 	Monitor *m;
+	long long now, late;
+	unsigned int key, i;
+
+	/* a request held back earlier goes along, overridden by this one */
+	if (c->cold->cfgpending.value_mask) {
+		configurefold(&c->cold->cfgpending, ev);
+		*ev = c->cold->cfgpending;
+	}
+	/* token bucket: cfgrate requests per second, bursts of cfgburst; the
+	 * rest waits, folded into one, for configurelater() */
+	now = monotime();
+	if ((late = c->cold->cfgtat - now - cfgburst * 1000 / cfgrate) > 0) {
+		cfgstats[CfgLimited]++;
+		if (!c->cold->cfgpending.value_mask)
+			settimer(late, configurelater, c->win);
+		c->cold->cfgpending = *ev;
+		return;
+	}
+	c->cold->cfgpending.value_mask = 0;
+	c->cold->cfgtat = MAX(c->cold->cfgtat, now) + 1000 / cfgrate;
+	if (ev->value_mask & CWBorderWidth) {
+		c->bw = ev->border_width;
+		/* a folded request may carry geometry along */
+		if (!(ev->value_mask & (CWX|CWY|CWWidth|CWHeight)))
+			return;
+	}
+	if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) {
+		m = c->mon;
+		if (ev->value_mask & CWX) {
+			c->cold->oldx = c->x;
+			c->x = m->mx + ev->x;
+		}
+		if (ev->value_mask & CWY) {
+			c->cold->oldy = c->y;
+			c->y = m->my + ev->y;
+		}
+		if (ev->value_mask & CWWidth) {
+			c->cold->oldw = c->w;
+			c->w = ev->width;
+		}
+		if (ev->value_mask & CWHeight) {
+			c->cold->oldh = c->h;
+			c->h = ev->height;
+		}
+		if ((c->x + c->w) > m->mx + m->mw && c->isfloating)
+			c->x = m->mx + (m->mw / 2 - WIDTH(c) / 2); /* center in x direction */
+		if ((c->y + c->h) > m->my + m->mh && c->isfloating)
+			c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
+		if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
+			configure(c);
+		if (ISVISIBLE(c))
+			XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+	} else {
+		/* a repeated request gets no new answer until our geometry changes */
+		int v[] = { ev->value_mask, ev->x, ev->y, ev->width, ev->height,
+		            ev->border_width, c->x, c->y, c->w, c->h, c->bw };
+		for (key = 2166136261u, i = 0; i < LENGTH(v); i++)
+			key = (key ^ v[i]) * 16777619u;
+		if (key == c->cold->cfgkey && key)
+			cfgstats[CfgUnchanged]++;
+		else {
+			c->cold->cfgkey = key;
+			configure(c);
+		}
+	}
+}
+
+/* overrides the fields of ev that n sets */
+void
+configurefold(XConfigureRequestEvent *ev, const XConfigureRequestEvent *n)
+{
+	if (n->value_mask & CWX)
+		ev->x = n->x;
+	if (n->value_mask & CWY)
+		ev->y = n->y;
+	if (n->value_mask & CWWidth)
+		ev->width = n->width;
+	if (n->value_mask & CWHeight)
+		ev->height = n->height;
+	if (n->value_mask & CWBorderWidth)
+		ev->border_width = n->border_width;
+	if (n->value_mask & CWSibling)
+		ev->above = n->above;
+	if (n->value_mask & CWStackMode)
+		ev->detail = n->detail;
+	ev->value_mask |= n->value_mask;
+}
+
+/* applies the request the rate limiter held back, see configureclient() */
+void
+configurelater(unsigned long w)
+{
+	XConfigureRequestEvent ev;
 	Client *c;
+
+	if ((c = wintoclient(w)) && c->cold->cfgpending.value_mask) {
+		ev = c->cold->cfgpending;
+		configureclient(c, &ev);
+	}
+}
+
+void
+configurenotify(XEvent *e)
+{
 	XConfigureEvent *ev = &e->xconfigure;
-	int dirty;
-
-	/* TODO: updategeom handling sucks, needs to be simplified */
-	if (ev->window == root) {
-		dirty = (sw != ev->width || sh != ev->height);
-		sw = ev->width;
-		sh = ev->height;
-		if (updategeom() || dirty) {
+
+	/* a blackout changes the screen but not where windows belong */
+	if (ev->window == root && !blackedout) {
+		if (sw != ev->width || sh != ev->height) {
+			sw = ev->width;
+			sh = ev->height;
 			drw_resize(drw, sw, bh);
-			updatebars();
-			for (m = mons; m; m = m->next) {
-				for (c = m->clients; c; c = c->next)
-					if (c->isfullscreen)
-						resizeclient(c, m->mx, m->my, m->mw, m->mh);
-				XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
-			}
-			focus(NULL);
-			arrange(NULL);
 		}
+		/* one xrandr call yields a burst of events, settle them at once */
+		settimer(0, updatetopology, 0);
 	}
 }
 
@@ -631,42 +1470,20 @@ void
 configurerequest(XEvent *e)
 {
 	Client *c;
-	Monitor *m;
 	XConfigureRequestEvent *ev = &e->xconfigurerequest;
+	XEvent next;
 	XWindowChanges wc;
 
-	if ((c = wintoclient(ev->window))) {
-		if (ev->value_mask & CWBorderWidth)
-			c->bw = ev->border_width;
-		else if (c->isfloating || !selmon->lt[selmon->sellt]->arrange) {
-			m = c->mon;
-			if (ev->value_mask & CWX) {
-				c->oldx = c->x;
-				c->x = m->mx + ev->x;
-			}
-			if (ev->value_mask & CWY) {
-				c->oldy = c->y;
-				c->y = m->my + ev->y;
-			}
-			if (ev->value_mask & CWWidth) {
-				c->oldw = c->w;
-				c->w = ev->width;
-			}
-			if (ev->value_mask & CWHeight) {
-				c->oldh = c->h;
-				c->h = ev->height;
-			}
-			if ((c->x + c->w) > m->mx + m->mw && c->isfloating)
-				c->x = m->mx + (m->mw / 2 - WIDTH(c) / 2); /* center in x direction */
-			if ((c->y + c->h) > m->my + m->mh && c->isfloating)
-				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
-			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
-				configure(c);
-			if (ISVISIBLE(c))
-				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
-		} else
-			configure(c);
-	} else {
+	/* only the latest request matters, fold those already queued into it */
+	cfgstats[CfgRequests]++;
+	while (XCheckTypedWindowEvent(dpy, ev->window, ConfigureRequest, &next)) {
+		configurefold(ev, &next.xconfigurerequest);
+		cfgstats[CfgRequests]++;
+		cfgstats[CfgCoalesced]++;
+	}
+	if ((c = wintoclient(ev->window)))
+		configureclient(c, ev);
+	else {
 		wc.x = ev->x;
 		wc.y = ev->y;
 		wc.width = ev->width;
@@ -676,7 +1493,49 @@ configurerequest(XEvent *e)
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
-	XSync(dpy, False);
+}
+
+/* serve one request on the control socket; replies are plain text */
+void
+ctlaccept(int fd, short revents)
+{
+	struct timeval tv = { 0, 100000 }; /* a stuck client must not stall the WM */
+	char buf[512];
+	ssize_t n;
+	size_t i, len;
+	FILE *out;
+	int c;
+
+	if ((c = accept(fd, NULL, NULL)) < 0)
+		return;
+	fcntl(c, F_SETFD, FD_CLOEXEC); /* commands may spawn */
+	setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+	if ((n = read(c, buf, sizeof buf - 1)) <= 0 || !(out = fdopen(c, "w"))) {
+		close(c);
+		return;
+	}
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	for (i = 0; i < LENGTH(commands); i++) {
+		len = strlen(commands[i].name);
+		if (!strncmp(buf, commands[i].name, len) && (!buf[len] || buf[len] == ' ')) {
+			flight_record(FlightCommand, i, 0, commands[i].name);
+			commands[i].func(out, buf[len] ? buf + len + 1 : "");
+			break;
+		}
+	}
+	if (i == LENGTH(commands))
+		fprintf(out, "error: unknown command '%s'\n", buf);
+	fclose(out);
+}
+
+/* SIGSEGV and friends: leave the flight recorder behind, then die of sig */
+void
+crash(int sig)
+{
+	flight_dump();
+	raise(sig);
 }
 
 Monitor *
@@ -697,19 +1556,38 @@ createmon(void)
 }
 
 void
-destroynotify(XEvent *e)
+defer(unsigned int work)
 {
-	Client *c;
-	XDestroyWindowEvent *ev = &e->xdestroywindow;
-
-	if ((c = wintoclient(ev->window)))
-		unmanage(c, 1);
+	deferred |= work;
 }
 
 void
-detach(Client *c)
+delwatch(int fd)
 {
-	Client **tc;
+	int i;
+
+	for (i = 0; i < nwatches; i++)
+		if (watches[i].fd == fd) {
+			memmove(&watches[i], &watches[i + 1], (nwatches - i - 1) * sizeof(Watch));
+			nwatches--;
+			return;
+		}
+}
+
+void
+destroynotify(XEvent *e)
+{
+	Client *c;
+	XDestroyWindowEvent *ev = &e->xdestroywindow;
+
+	if ((c = wintoclient(ev->window)))
+		unmanage(c, 1);
+}
+
+void
+detach(Client *c)
+{
+	Client **tc;
 
 	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
 	*tc = c->next;
@@ -747,14 +1625,14 @@ dirtomon(int dir)
 void
 drawbar(Monitor *m)
 {
-	int x, w, tw = 0;
-	int boxs = drw->fonts->h / 9;
-	int boxw = drw->fonts->h / 6 + 2;
+	int x, w, tw = 0, boxs, boxw;
 	unsigned int i, occ = 0, urg = 0;
 	Client *c;
 
 	if (!m->showbar)
 		return;
+	boxs = drw->fonts->h / 9;
+	boxw = drw->fonts->h / 6 + 2;
 
 	/* draw status first so it can be overdrawn by tags later */
 	if (m == selmon) { /* status is only drawn on selected monitor */
@@ -786,7 +1664,7 @@ drawbar(Monitor *m)
 	if ((w = m->ww - tw - x) > bh) {
 		if (m->sel) {
 			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]);
-			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->name, 0);
+			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->cold->name, 0);
 			if (m->sel->isfloating)
 				drw_rect(drw, x + boxs, boxs, boxw, boxw, m->sel->isfixed, 0);
 		} else {
@@ -825,6 +1703,20 @@ enternotify(XEvent *e)
 	focus(c);
 }
 
+#ifdef ESPEAK
+/* synthesizes in process, for when speech-dispatcher is down; espeak-ng
+ * is loaded with the first message and keeps its audio stream open */
+int
+espeaksay(const char *rate, const char *text)
+{
+	static int loaded = 0; /* -1 when it failed to load */
+
+	if (!loaded)
+		loaded = speech_espeak_open() < 0 ? -1 : 1;
+	return loaded > 0 ? speech_espeak_say(rate, text) : -1;
+}
+#endif
+
 void
 expose(XEvent *e)
 {
@@ -835,13 +1727,70 @@ expose(XEvent *e)
 		drawbar(m);
 }
 
+/* the first executable start-orca in the usual places, 0 if there is one */
+int
+findorca(char *buf, size_t len)
+{
+	const char *home = getenv("HOME");
+	char self[PATH_MAX], *slash = NULL;
+	ssize_t n;
+	size_t i;
+
+	if ((n = readlink("/proc/self/exe", self, sizeof self - 1)) > 0) {
+		self[n] = '\0';
+		if ((slash = strrchr(self, '/')))
+			*slash = '\0';
+	}
+	/* user's local bin, system bin, next to our own binary, a repository
+	 * checkout, then /usr/local */
+	const char *where[][2] = {
+		{ "%s/.local/bin/start-orca", home },
+		{ "%s/usr/bin/start-orca", "" },
+		{ "%s/scripts/start-orca", slash ? self : NULL },
+		{ "%s/Documents/GitHub/DINA/scripts/start-orca", home },
+		{ "%s/usr/local/bin/start-orca", "" },
+	};
+	for (i = 0; i < LENGTH(where); i++)
+		if (where[i][1] && (size_t)snprintf(buf, len, where[i][0], where[i][1]) < len
+		&& !access(buf, X_OK))
+			return 0;
+	buf[0] = '\0';
+	return -1;
+}
+
+void
+flushdeferred(void)
+{
+	Client *c;
+	Monitor *m;
+	unsigned int work = deferred;
+
+	deferred = 0;
+	if (work & DeferTitles)
+		for (m = mons; m; m = m->next)
+			for (c = m->clients; c; c = c->next)
+				if (c->titledirty)
+					updatetitle(c);
+	if (work & DeferPersist)
+		saveapptagpersist();
+}
+
 void
 focus(Client *c)
 {
 	if (!c || !ISVISIBLE(c))
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
+	/* a title deferred under pressure is about to be spoken; refreshing
+	 * it may apply a title rule that moves the window away */
+	if (c && c->titledirty) {
+		updatetitle(c);
+		if (!ISVISIBLE(c))
+			for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
+	}
 	if (selmon->sel && selmon->sel != c)
 		unfocus(selmon->sel, 0);
+	if (c && c != selmon->sel)
+		settimer(0, pingsel, 0); /* check the new window right away */
 	if (c) {
 		if (c->mon != selmon)
 			selmon = c->mon;
@@ -850,16 +1799,29 @@ focus(Client *c)
 		detachstack(c);
 		attachstack(c);
 		grabbuttons(c, 1);
-		XSetWindowBorder(dpy, c->win, scheme[SchemeSel][ColBorder].pixel);
+		backend->border(c->win, scheme[SchemeSel][ColBorder].pixel);
 		setfocus(c);
 	} else {
-		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		backend->focus(root);
+		backend->delprop(root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
+	if (c)
+		selmon->tagsel[ffs(selmon->tagset[selmon->seltags]) - 1] = c;
 	drawbars();
 }
 
+/* drop c as the remembered selection of the given tags on m */
+void
+forgetsel(Monitor *m, Client *c, unsigned int tags)
+{
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(m->tagsel); i++)
+		if (m->tagsel[i] == c && tags & 1 << i)
+			m->tagsel[i] = NULL;
+}
+
 /* there are some broken focus acquiring clients needing extra handling */
 void
 focusin(XEvent *e)
@@ -932,6 +1894,16 @@ focuswindowbyindex(const Arg *arg)
 	}
 }
 
+void
+freeclient(Client *c)
+{
+	unintern(c->cold->name);
+	unintern(c->cold->class);
+	unintern(c->cold->instance);
+	c->next = freeclients;
+	freeclients = c;
+}
+
 Atom
 getatomprop(Client *c, Atom prop)
 {
@@ -948,6 +1920,91 @@ getatomprop(Client *c, Atom prop)
 	return atom;
 }
 
+/* _NET_WM_PID of w, if its WM_CLIENT_MACHINE says it runs on this host */
+pid_t
+getlocalpid(Window w)
+{
+	int di;
+	unsigned long dl;
+	unsigned char *p = NULL;
+	Atom da;
+	XTextProperty tp;
+	char host[256];
+	pid_t pid = 0;
+
+	if (!XGetWMClientMachine(dpy, w, &tp))
+		return 0;
+	if (tp.value && tp.format == 8 && !gethostname(host, sizeof host)
+	&& !strncmp(host, (char *)tp.value, sizeof host)
+	&& XGetWindowProperty(dpy, w, netatom[NetWMPid], 0L, 1L, False, XA_CARDINAL,
+		&da, &di, &dl, &dl, &p) == Success && p) {
+		pid = *(long *)p;
+		XFree(p);
+	}
+	XFree(tp.value);
+	return pid > 1 && pid != getpid() ? pid : 0;
+}
+
+/* unique monitor geometries from RandR 1.5 or Xinerama, 0 if neither is active */
+int
+getmongeoms(MonGeom **geoms)
+{
+	int i, j, n = 0;
+	MonGeom *g = NULL;
+
+#ifdef XRANDR
+	if (rrevbase) {
+		XRRMonitorInfo *info = XRRGetMonitors(dpy, root, True, &n);
+
+		if (info && n > 0) {
+			g = ecalloc(n, sizeof(MonGeom));
+			for (i = 0; i < n; i++) {
+				g[i].x = info[i].x;
+				g[i].y = info[i].y;
+				g[i].w = info[i].width;
+				g[i].h = info[i].height;
+			}
+		}
+		if (info)
+			XRRFreeMonitors(info);
+	} else
+#endif /* XRANDR */
+#ifdef XINERAMA
+	if (XineramaIsActive(dpy)) {
+		XineramaScreenInfo *info = XineramaQueryScreens(dpy, &n);
+
+		if (info && n > 0) {
+			g = ecalloc(n, sizeof(MonGeom));
+			for (i = 0; i < n; i++) {
+				g[i].x = info[i].x_org;
+				g[i].y = info[i].y_org;
+				g[i].w = info[i].width;
+				g[i].h = info[i].height;
+			}
+		}
+		if (info)
+			XFree(info);
+	} else
+#endif /* XINERAMA */
+		n = 0;
+	if (!g)
+		return 0;
+	/* only consider unique geometries as separate screens */
+	for (i = 0, j = 0; i < n; i++)
+		if (isuniquegeom(g, j, &g[i]))
+			g[j++] = g[i];
+	*geoms = g;
+	return j;
+}
+
+Cursor
+getcursor(int cur)
+{
+	if (!cursor[cur])
+		cursor[cur] = drw_cur_create(drw, cursorshape[cur]);
+	return cursor[cur]->cursor;
+}
+
 int
 getrootptr(int *x, int *y)
 {
@@ -999,25 +2056,21 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 	return 1;
 }
 
+/* numlockmask is kept current by grabkeys() */
 void
 grabbuttons(Client *c, int focused)
 {
-	updatenumlockmask();
-	{
-		unsigned int i, j;
-		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
-		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
-		if (!focused)
-			XGrabButton(dpy, AnyButton, AnyModifier, c->win, False,
-				BUTTONMASK, GrabModeSync, GrabModeSync, None, None);
-		for (i = 0; i < LENGTH(buttons); i++)
-			if (buttons[i].click == ClkClientWin)
-				for (j = 0; j < LENGTH(modifiers); j++)
-					XGrabButton(dpy, buttons[i].button,
-						buttons[i].mask | modifiers[j],
-						c->win, False, BUTTONMASK,
-						GrabModeAsync, GrabModeSync, None, None);
-	}
+	unsigned int i, j;
+	unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
+
+	backend->ungrabbuttons(c->win);
+	if (!focused)
+		backend->grabbutton(c->win, AnyButton, AnyModifier, 1);
+	for (i = 0; i < LENGTH(buttons); i++)
+		if (buttons[i].click == ClkClientWin)
+			for (j = 0; j < LENGTH(modifiers); j++)
+				backend->grabbutton(c->win, buttons[i].button,
+					buttons[i].mask | modifiers[j], 0);
 }
 
 void
@@ -1048,6 +2101,210 @@ grabkeys(void)
 	}
 }
 
+/* Crashes are announced through notify_say(), unless speech-dispatcher is
+ * what crashed: then speakcmd talks to the sound card directly. */
+void
+helperannounce(Supervised *s, const char *text)
+{
+	Arg tone = SHCMD_NOTIFY("play -nq synth 0.1 sine 300 sine 200 vol 0.3");
+
+	spawn(&tone);
+	if (s->helper->ready != ReadySpeech)
+		notify_say("-40", text);
+	else
+		speakcmdsay("-40", text);
+}
+
+/* A helper's pidfd turned readable, so it exited.  Helpers that ran for
+ * helperstable ms are announced and restarted right away, the others back
+ * off until helpertries quick deaths in a row. */
+void
+helperexit(int fd, short revents)
+{
+	Supervised *s;
+	siginfo_t si = { 0 };
+	long long up;
+	unsigned int delay, n;
+	char how[64], text[128];
+	int i;
+
+	for (i = 0; i < nsupervised && supervised[i].pidfd != fd; i++);
+	if (i == nsupervised)
+		return;
+	s = &supervised[i];
+	if (!waitid(P_PIDFD, fd, &si, WEXITED | WNOHANG) && !si.si_pid)
+		return; /* still running */
+	delwatch(fd);
+	close(fd);
+	flight_record(FlightExit, si.si_status, s->pid, s->helper->name);
+	up = monotime() - s->started;
+	if (si.si_pid && si.si_code == CLD_EXITED)
+		snprintf(how, sizeof how, "exited with status %d", si.si_status);
+	else if (si.si_pid)
+		snprintf(how, sizeof how, "killed by signal %d", si.si_status);
+	else /* reaped before we took it over, see setup() */
+		snprintf(how, sizeof how, "exited");
+	fprintf(stderr, "DINA: helper %s (pid %d) %s after %lld ms\n",
+		s->helper->name, (int)s->pid, how, up);
+	s->pid = 0;
+	s->pidfd = -1;
+	if (!running)
+		return;
+	if (up >= helperstable) {
+		s->stable = 1;
+		s->fails = 0;
+	} else if (++s->fails >= helpertries) {
+		s->gaveup = 1;
+		fprintf(stderr, "DINA: helper %s failed %u times in a row, giving up\n",
+			s->helper->name, s->fails);
+		/* one that never came up is a setup problem, not news */
+		if (s->stable) {
+			snprintf(text, sizeof text, "%s keeps failing and was stopped", s->helper->name);
+			helperannounce(s, text);
+		}
+		/* nothing waits for it any longer */
+		helperready(s, "failed");
+		return;
+	}
+	for (delay = helperbackoff, n = 1; n < s->fails && delay < helperbackoffmax; n++)
+		delay *= 2;
+	if (up >= helperstable) {
+		snprintf(text, sizeof text, "%s stopped, restarting", s->helper->name);
+		helperannounce(s, text);
+	}
+	settimer(MIN(delay, helperbackoffmax), helperstart, i);
+}
+
+/* ReadySpeech: speech-dispatcher cannot tell when it is up, so its socket
+ * is tried every BOOTPROBE ms until it answers or bootwait runs out; the
+ * connection is kept for notify_say() */
+void
+helperprobe(unsigned long i)
+{
+	Supervised *s = &supervised[i];
+	int fd;
+
+	if (s->readyat)
+		return;
+	if ((fd = speech_open()) < 0) {
+		settimer(BOOTPROBE, helperprobe, i);
+		return;
+	}
+	if (speechfd < 0) {
+		speechfd = fd;
+		addwatch(speechfd, POLLIN, speechevent);
+	} else
+		close(fd);
+	voices[0].downuntil = 0;
+	helperready(s, "answered");
+}
+
+/* Marks a helper ready during the boot: starts the helpers waiting for it,
+ * speaks what was held back once no hold helper is missing any more, and
+ * logs the boot once none is. */
+void
+helperready(Supervised *s, const char *how)
+{
+	int i, all = 1, hold = 0;
+
+	if (s->readyat)
+		return;
+	s->readyat = monotime();
+	s->readyhow = how;
+	if (booting && s->helper->ready == ReadySpeech)
+		notify_started(0);
+	bootstep();
+	for (i = 0; i < nsupervised; i++)
+		if (!supervised[i].readyat) {
+			all = 0;
+			hold |= supervised[i].helper->hold;
+		}
+	if (!hold)
+		releasespeech(0);
+	if (all && booting)
+		settimer(0, bootdone, 0); /* once run() started, after the scan */
+}
+
+/* starts supervised[i] in a session of its own and watches its pidfd */
+void
+helperstart(unsigned long i)
+{
+	Supervised *s = &supervised[i];
+	struct sigaction sa;
+	pid_t pid;
+	int fd;
+
+	if (s->pid || s->gaveup || s->external || !running)
+		return;
+	/* a speech-dispatcher of the session is used as it is, a second one
+	 * started with --run-single would fail on the same socket */
+	if (!s->booted && s->helper->ready == ReadySpeech && (fd = speech_open()) >= 0) {
+		if (speechfd < 0) {
+			speechfd = fd;
+			addwatch(speechfd, POLLIN, speechevent);
+		} else
+			close(fd);
+		voices[0].downuntil = 0;
+		s->external = 1;
+		s->booted = monotime();
+		helperready(s, "already running");
+		return;
+	}
+	if ((pid = fork()) == 0) {
+		if (dpy)
+			close(ConnectionNumber(dpy));
+		setsid();
+
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = 0;
+		sa.sa_handler = SIG_DFL;
+		sigaction(SIGCHLD, &sa, NULL);
+		sigaction(SIGPIPE, &sa, NULL);
+
+		execvp(s->helper->cmd[0], (char **)s->helper->cmd);
+		fprintf(stderr, "DINA: execvp '%s' failed: %s\n", s->helper->cmd[0], strerror(errno));
+		_exit(127);
+	}
+	if (pid < 0) {
+		fprintf(stderr, "DINA: helper %s: fork: %s\n", s->helper->name, strerror(errno));
+		settimer(helperbackoffmax, helperstart, i);
+		return;
+	}
+	flight_record(FlightSpawn, pid, 0, s->helper->name);
+	if (s->started)
+		s->restarts++;
+	s->pid = pid;
+	s->started = monotime();
+	if ((fd = syscall(SYS_pidfd_open, pid, 0)) < 0) {
+		fprintf(stderr, "DINA: helper %s: pidfd_open: %s, not supervised\n",
+			s->helper->name, strerror(errno));
+		s->gaveup = 1;
+	} else {
+		s->pidfd = fd;
+		addwatch(fd, POLLIN, helperexit);
+	}
+	if (s->booted)
+		return;
+	s->booted = s->started;
+	if (s->helper->ready == ReadyStarted) {
+		helperready(s, "started");
+		return;
+	}
+	if (s->helper->ready == ReadySpeech)
+		settimer(0, helperprobe, i);
+	settimer(bootwait, helpertimeout, i);
+}
+
+void
+helpertimeout(unsigned long i)
+{
+	if (supervised[i].readyat)
+		return;
+	fprintf(stderr, "DINA: helper %s not ready after %u ms, going on without it\n",
+		supervised[i].helper->name, bootwait);
+	helperready(&supervised[i], "timed out");
+}
+
 void
 incnmaster(const Arg *arg)
 {
@@ -1055,17 +2312,41 @@ incnmaster(const Arg *arg)
 	arrange(selmon);
 }
 
-#ifdef XINERAMA
-static int
-isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
+/* return a shared copy of s, released again with unintern() */
+const char *
+intern(const char *s)
+{
+	unsigned int h = 2166136261u; /* FNV-1a */
+	const char *p;
+	size_t len;
+	Str *str;
+
+	for (p = s; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+	for (str = strtab[h % LENGTH(strtab)]; str; str = str->next)
+		if (str->hash == h && !strcmp(str->s, s)) {
+			str->refs++;
+			return str->s;
+		}
+	len = p - s;
+	str = ecalloc(1, sizeof(Str) + len + 1);
+	memcpy(str->s, s, len + 1);
+	str->hash = h;
+	str->refs = 1;
+	str->next = strtab[h % LENGTH(strtab)];
+	strtab[h % LENGTH(strtab)] = str;
+	return str->s;
+}
+
+int
+isuniquegeom(MonGeom *unique, size_t n, MonGeom *info)
 {
 	while (n--)
-		if (unique[n].x_org == info->x_org && unique[n].y_org == info->y_org
-		&& unique[n].width == info->width && unique[n].height == info->height)
+		if (unique[n].x == info->x && unique[n].y == info->y
+		&& unique[n].w == info->w && unique[n].h == info->h)
 			return 0;
 	return 1;
 }
-#endif /* XINERAMA */
 
 void
 keypress(XEvent *e)
@@ -1076,27 +2357,138 @@ keypress(XEvent *e)
 
 	ev = &e->xkey;
 	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
+	if (tracing) /* the key, not the binding, so another config.h replays it */
+		trace_record(TraceKey, &(TracedKey){ keysym, CLEANMASK(ev->state) },
+			sizeof(TracedKey), NULL, 0);
 	for (i = 0; i < LENGTH(keys); i++)
 		if (keysym == keys[i].keysym
 		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-		&& keys[i].func)
+		&& keys[i].func) {
+			flight_record(FlightKey, i, keysym, NULL);
 			keys[i].func(&(keys[i].arg));
+		}
 }
 
+/* Asks the selected window to close.  If it is still around after
+ * killtimeout, or this is the second request, killescalate() takes over. */
 void
 killclient(const Arg *arg)
 {
-	if (!selmon->sel)
+	Client *c = selmon->sel;
+
+	if (!c)
 		return;
-	if (!sendevent(selmon->sel, wmatom[WMDelete])) {
-		XGrabServer(dpy);
-		XSetErrorHandler(xerrordummy);
-		XSetCloseDownMode(dpy, DestroyAll);
-		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
-		XUngrabServer(dpy);
+	if (c->hung)
+		c->closing = 1; /* known to be frozen, no point in asking */
+	if (!c->closing && sendevent(c, wmatom[WMDelete])) {
+		c->closing = 1;
+		settimer(killtimeout, killescalate, c->win);
+	} else
+		killescalate(c->win);
+}
+
+/* disconnect a window that ignored WM_DELETE_WINDOW and terminate its process */
+void
+killescalate(unsigned long w)
+{
+	Client *c;
+	pid_t pid;
+	int fd = -1;
+	char text[1100];
+
+	if (!(c = wintoclient(w)))
+		return; /* closed in time */
+	/* windows without WM_DELETE_WINDOW only lose their connection; the
+	 * process is held through a pidfd so a reused pid is never hit */
+	pid = c->closing ? getlocalpid(w) : 0;
+	if (pid > 0)
+		fd = syscall(SYS_pidfd_open, pid, 0);
+	if (c->closing && !shuttingdown) { /* shutdownstep() names them all at once */
+		snprintf(text, sizeof text, "%.1024s is not responding, closing it", c->cold->name);
+		notify_say("-40", text);
+	}
+	XGrabServer(dpy);
+	XSetErrorHandler(xerrordummy);
+	XSetCloseDownMode(dpy, DestroyAll);
+	XKillClient(dpy, w);
+	XSync(dpy, False);
+	XSetErrorHandler(xerror);
+	XUngrabServer(dpy);
+	/* a frozen process may outlive its X connection */
+	if (fd < 0) { /* no pidfds before Linux 5.3: SIGTERM only */
+		if (pid > 0)
+			kill(pid, SIGTERM);
+		return;
+	}
+	if (syscall(SYS_pidfd_send_signal, fd, SIGTERM, NULL, 0) < 0)
+		close(fd);
+	else
+		settimer(killtimeout, killpid, fd);
+}
+
+/* the process behind pidfd fd ignored SIGTERM for killtimeout ms */
+void
+killpid(unsigned long fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int killed;
+
+	/* readable once it exited, zombies included */
+	killed = poll(&pfd, 1, 0) == 0
+		&& syscall(SYS_pidfd_send_signal, (int)fd, SIGKILL, NULL, 0) == 0;
+	close(fd);
+	if (killed && !shuttingdown)
+		notify_say("-40", "Process killed");
+}
+
+/* asks the resident app-launcher to show itself, starting it if needed */
+void
+launcher(const Arg *arg)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	Arg cmd = { .v = launchershowcmd };
+	int fd;
+
+	sockpath(addr.sun_path, sizeof addr.sun_path, "dina-launcher");
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0) {
+		fcntl(fd, F_SETFL, O_NONBLOCK); /* a wedged launcher must not stall us */
+		if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0
+		&& send(fd, "show\n", 5, MSG_NOSIGNAL) == 5) {
+			close(fd);
+			return;
+		}
+		close(fd);
 	}
+	spawn(&cmd);
+}
+
+/* Asks every window to close at once and gives them shutdowntimeout ms
+ * together, see shutdownstep(); windows that cannot be asked are
+ * disconnected right away.  Then DINA exits, running poweroffcmd or
+ * rebootcmd for those. */
+void
+logout(const Arg *arg)
+{
+	static const char *what[] = {
+		[ShutdownLogout] = "Logging out",
+		[ShutdownPoweroff] = "Shutting down",
+		[ShutdownReboot] = "Restarting",
+	};
+	Monitor *m;
+	Client *c;
+
+	if (shuttingdown || arg->i <= ShutdownNone || arg->i > ShutdownReboot)
+		return;
+	shuttingdown = arg->i;
+	notify_say("-40", what[arg->i]);
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (!c->closing && sendevent(c, wmatom[WMDelete]))
+				c->closing = 1;
+			else if (!c->closing)
+				killescalate(c->win);
+	settimer(shutdowntimeout, shutdownstep, 1);
+	settimer(0, shutdownstep, 0);
 }
 
 void
@@ -1106,19 +2498,28 @@ manage(Window w, XWindowAttributes *wa)
 	Window trans = None;
 	XWindowChanges wc;
 
-	c = ecalloc(1, sizeof(Client));
+	c = allocclient();
 	c->win = w;
 	/* geometry */
-	c->x = c->oldx = wa->x;
-	c->y = c->oldy = wa->y;
-	c->w = c->oldw = wa->width;
-	c->h = c->oldh = wa->height;
-	c->oldbw = wa->border_width;
+	c->x = c->cold->oldx = wa->x;
+	c->y = c->cold->oldy = wa->y;
+	c->w = c->cold->oldw = wa->width;
+	c->h = c->cold->oldh = wa->height;
+	c->cold->oldbw = wa->border_width;
 
 	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	updateclass(c);
+	flight_record(FlightManage, 0, w, c->cold->class);
+	if (restoreclient(c))
+		XGetTransientForHint(dpy, w, &trans);
+	else if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
+	} else if (!strcmp(c->cold->instance, launcherinstance)) {
+		/* the resident launcher opens where the user is, without rules
+		 * or persistence getting in the way */
+		c->mon = selmon;
+		c->tags = selmon->tagset[selmon->seltags];
 	} else {
 		c->mon = selmon;
 		applyrules(c);
@@ -1142,7 +2543,7 @@ manage(Window w, XWindowAttributes *wa)
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0);
 	if (!c->isfloating)
-		c->isfloating = c->oldstate = trans != None || c->isfixed;
+		c->isfloating = c->cold->oldstate = trans != None || c->isfixed;
 	if (c->isfloating)
 		XRaiseWindow(dpy, c->win);
 	attach(c);
@@ -1157,6 +2558,8 @@ manage(Window w, XWindowAttributes *wa)
 	arrange(c->mon);
 	XMapWindow(dpy, c->win);
 	focus(NULL);
+	if (tracing)
+		tracewindow(c, trans);
 }
 
 void
@@ -1165,7 +2568,7 @@ mappingnotify(XEvent *e)
 	XMappingEvent *ev = &e->xmapping;
 
 	XRefreshKeyboardMapping(ev);
-	if (ev->request == MappingKeyboard)
+	if (ev->request == MappingKeyboard || ev->request == MappingModifier)
 		grabkeys();
 }
 
@@ -1182,29 +2585,52 @@ maprequest(XEvent *e)
 }
 
 void
-notify_tag(int tag)
+notify_say(const char *rate, const char *text)
+{
+	/* until the screen reader is up, Orca starting would talk over us */
+	if (holdspeech) {
+		if (nheldspeech < LENGTH(heldspeech) && (heldspeech[nheldspeech].text = strdup(text))) {
+			snprintf(heldspeech[nheldspeech].rate, sizeof heldspeech[nheldspeech].rate, "%s", rate);
+			nheldspeech++;
+		}
+		return;
+	}
+	speak(rate, text);
+}
+
+void
+notify_tag(int tag, const char *title)
 {
 	// Play a unique sound for tag switching
-	char cmd[256];
+	char cmd[256], text[1100];
 	snprintf(cmd, sizeof(cmd), 
-		"play -nq synth 0.1 sine %d vol 0.3 & spd-say -r -50 \"Tag %d\"", 
-		400 + (tag * 50), tag);
+		"play -nq synth 0.1 sine %d vol 0.3", 
+		400 + (tag * 50));
 	
 	Arg arg = SHCMD_NOTIFY(cmd);
 	spawn(&arg);
+
+	// Name the window we land on in the same utterance as the tag
+	if (title)
+		snprintf(text, sizeof(text), "Tag %d, %.1024s", tag, title);
+	else
+		snprintf(text, sizeof(text), "Tag %d", tag);
+	notify_say("-50", text);
 }
 
 void
 notify_window_move(int from_tag, int to_tag)
 {
 	// Play a sound for window movement between tags and announce it
-	char cmd[256];
+	char cmd[256], text[64];
 	snprintf(cmd, sizeof(cmd), 
-		"play -nq synth 0.1 sine %d sine %d vol 0.3 & spd-say -r -40 \"Window moved from tag %d to tag %d\"", 
-		400 + (from_tag * 50), 400 + (to_tag * 50), from_tag, to_tag);
+		"play -nq synth 0.1 sine %d sine %d vol 0.3", 
+		400 + (from_tag * 50), 400 + (to_tag * 50));
 	
 	Arg arg = SHCMD_NOTIFY(cmd);
 	spawn(&arg);
+	snprintf(text, sizeof(text), "Window moved from tag %d to tag %d", from_tag, to_tag);
+	notify_say("-40", text);
 }
 
 void
@@ -1212,12 +2638,28 @@ notify_startup(void)
 {
 	// Play a distinctive startup sound and announce that DINA has started
 	// This helps users know DINA is running even if other components (like Orca) fail
-	char cmd[256];
-	snprintf(cmd, sizeof(cmd), 
-		"play -nq synth 0.15 sine 500 sine 800 sine 1200 vol 0.4 & spd-say -r -30 \"DINA window manager started\"");
-	
-	Arg arg = SHCMD_NOTIFY(cmd);
+	Arg arg = SHCMD_NOTIFY("play -nq synth 0.15 sine 500 sine 800 sine 1200 vol 0.4");
+	int i;
+
 	spawn(&arg);
+	for (i = 0; i < nsupervised && supervised[i].helper->ready != ReadySpeech; i++);
+	if (i == nsupervised || supervised[i].readyat)
+		notify_started(0);
+	else /* helperready() does once speech-dispatcher answers */
+		settimer(speechbudget, notify_started, 1);
+}
+
+/* spoken ahead of what is held back for Orca, which starts after speech;
+ * data is set when speechbudget ran out first, so another voice says it */
+void
+notify_started(unsigned long data)
+{
+	if (startupms(StartSpeech) > 0)
+		return;
+	if (data) /* helperprobe() lets speech-dispatcher back in once it answers */
+		voices[0].downuntil = monotime() + speechretry;
+	speak("-30", "DINA window manager started");
+	startupmark(StartSpeech);
 }
 
 void
@@ -1235,6 +2677,15 @@ monocle(Monitor *m)
 		resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0);
 }
 
+long long
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 void
 motionnotify(XEvent *e)
 {
@@ -1269,7 +2720,7 @@ movemouse(const Arg *arg)
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
-		None, cursor[CurMove]->cursor, CurrentTime) != GrabSuccess)
+		None, getcursor(CurMove), CurrentTime) != GrabSuccess)
 		return;
 	if (!getrootptr(&x, &y))
 		return;
@@ -1319,6 +2770,79 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* the window did not answer its ping within pingtimeout */
+void
+pingcheck(unsigned long w)
+{
+	static const struct { unsigned int mask; const char *name; } mods[] = {
+		{ Mod4Mask, "Super" }, { Mod1Mask, "Alt" },
+		{ ControlMask, "Control" }, { ShiftMask, "Shift" },
+	};
+	Client *c;
+	char key[64] = "", text[1200];
+	const char *sym;
+	unsigned int i;
+
+	if (!(c = wintoclient(w)) || !c->cold->pingat || c->hung)
+		return;
+	c->hung = 1;
+	c->cold->pingtimeouts++;
+	if (c != selmon->sel)
+		return;
+	/* name the key bound to killclient, it need not be the default */
+	for (i = 0; i < LENGTH(keys) && keys[i].func != killclient; i++);
+	if (i < LENGTH(keys) && (sym = XKeysymToString(keys[i].keysym))) {
+		unsigned int j, mod = keys[i].mod;
+
+		for (j = 0; j < LENGTH(mods); j++)
+			if (mod & mods[j].mask)
+				snprintf(key + strlen(key), sizeof key - strlen(key), "%s ", mods[j].name);
+		snprintf(key + strlen(key), sizeof key - strlen(key), "%s", sym);
+	}
+	if (*key)
+		snprintf(text, sizeof text, "%.1024s is not responding. Press %s to close it.",
+			c->cold->name, key);
+	else
+		snprintf(text, sizeof text, "%.1024s is not responding. Use the close-window key to end it.",
+			c->cold->name);
+	notify_say("-40", text);
+}
+
+/* ping the focused window every pinginterval, one ping at a time */
+void
+pingsel(unsigned long data)
+{
+	Client *c = selmon->sel;
+
+	settimer(pinginterval, pingsel, 0);
+	if (!c || c->cold->pingat)
+		return;
+	if (sendevent(c, netatom[NetWMPing])) {
+		c->cold->pingat = monotime();
+		settimer(pingtimeout, pingcheck, c->win);
+	}
+}
+
+void
+pong(Client *c)
+{
+	ClientCold *cc = c->cold;
+	char text[1100];
+
+	if (!cc->pingat)
+		return;
+	cc->pinglast = monotime() - cc->pingat;
+	cc->pingmax = MAX(cc->pingmax, cc->pinglast);
+	cc->pingsum += cc->pinglast;
+	cc->pings++;
+	cc->pingat = 0;
+	if (c->hung) {
+		c->hung = 0;
+		snprintf(text, sizeof text, "%.1024s is responding again", cc->name);
+		notify_say("-40", text);
+	}
+}
+
 void
 pop(Client *c)
 {
@@ -1354,8 +2878,16 @@ propertynotify(XEvent *e)
 			updatewmhints(c);
 			drawbars();
 			break;
+		case XA_WM_CLASS:
+			updateclass(c);
+			break;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
+			if (pressured && c != c->mon->sel) {
+				c->titledirty = 1;
+				defer(DeferTitles);
+				return;
+			}
 			updatetitle(c);
 			if (c == c->mon->sel)
 				drawbar(c->mon);
@@ -1365,6 +2897,113 @@ propertynotify(XEvent *e)
 	}
 }
 
+void
+psievent(int fd, short revents)
+{
+	int r;
+
+	for (r = 0; r < PsiLast && psifd[r] != fd; r++);
+	if (r == PsiLast)
+		return;
+	if (revents & (POLLERR | POLLNVAL)) { /* trigger was torn down */
+		delwatch(fd);
+		close(fd);
+		psifd[r] = -1;
+		return;
+	}
+	psitrigger(r);
+}
+
+/* fallback for kernels that refuse unprivileged triggers: sample avg10 */
+void
+psipoll(unsigned long data)
+{
+	char path[64];
+	float avg;
+	FILE *f;
+	int r;
+
+	for (r = 0; r < PsiLast; r++) {
+		if (psifd[r] >= 0)
+			continue;
+		snprintf(path, sizeof path, PSI_DIR "/%s", psinames[r]);
+		if (!(f = fopen(path, "r")))
+			continue;
+		if (fscanf(f, "some avg10=%f", &avg) == 1 && avg >= psiavg)
+			psitrigger(r);
+		fclose(f);
+	}
+	settimer(psiwindow / 1000, psipoll, 0);
+}
+
+void
+psirelax(unsigned long r)
+{
+	pressured &= ~(1 << r);
+	if (!pressured)
+		flushdeferred();
+}
+
+void
+psisetup(void)
+{
+	char path[64], trigger[64];
+	int r, fd, sampling = 0;
+
+	if (access(PSI_DIR, R_OK) < 0)
+		return;
+	snprintf(trigger, sizeof trigger, "some %u %u", psistall, psiwindow);
+	for (r = 0; r < PsiLast; r++) {
+		snprintf(path, sizeof path, PSI_DIR "/%s", psinames[r]);
+		if ((fd = open(path, O_RDWR | O_NONBLOCK)) < 0
+		|| write(fd, trigger, strlen(trigger) + 1) < 0) {
+			if (fd >= 0)
+				close(fd);
+			sampling = 1;
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		psifd[r] = fd;
+		addwatch(fd, POLLPRI, psievent);
+	}
+	psimode = sampling ? "sampling" : "triggers";
+	if (sampling)
+		settimer(psiwindow / 1000, psipoll, 0);
+}
+
+/* resource r stalled; pressure ends psicalm ms after its last trigger */
+void
+psitrigger(int r)
+{
+	psicount[r]++;
+	if (!pressured)
+		boostspeech();
+	pressured |= 1 << r;
+	settimer(psicalm, psirelax, r);
+}
+
+/* client side of the control socket: DINA -q command [args...] */
+int
+query(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[BUFSIZ];
+	ssize_t n;
+	int fd, i;
+
+	sockpath(addr.sun_path, sizeof addr.sun_path, "dina");
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+	|| connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0)
+		die("DINA: cannot connect to %s:", addr.sun_path);
+	for (i = 0; i < argc; i++)
+		dprintf(fd, "%s%c", argv[i], i + 1 < argc ? ' ' : '\n');
+	shutdown(fd, SHUT_WR);
+	while ((n = read(fd, buf, sizeof buf)) > 0)
+		fwrite(buf, 1, n, stdout);
+	close(fd);
+	return EXIT_SUCCESS;
+}
+
 void
 quit(const Arg *arg)
 {
@@ -1397,14 +3036,14 @@ resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
 
-	c->oldx = c->x; c->x = wc.x = x;
-	c->oldy = c->y; c->y = wc.y = y;
-	c->oldw = c->w; c->w = wc.width = w;
-	c->oldh = c->h; c->h = wc.height = h;
+	c->cold->oldx = c->x; c->x = wc.x = x;
+	c->cold->oldy = c->y; c->y = wc.y = y;
+	c->cold->oldw = c->w; c->w = wc.width = w;
+	c->cold->oldh = c->h; c->h = wc.height = h;
 	wc.border_width = c->bw;
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+	backend->configure(c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 	configure(c);
-	XSync(dpy, False);
+	backend->sync(0);
 }
 
 void
@@ -1424,7 +3063,7 @@ resizemouse(const Arg *arg)
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
-		None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
+		None, getcursor(CurResize), CurrentTime) != GrabSuccess)
 		return;
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
 	do {
@@ -1468,36 +3107,278 @@ void
 restack(Monitor *m)
 {
 	Client *c;
-	XEvent ev;
 	XWindowChanges wc;
 
 	drawbar(m);
 	if (!m->sel)
 		return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
-		XRaiseWindow(dpy, m->sel->win);
+		backend->raise(m->sel->win);
 	if (m->lt[m->sellt]->arrange) {
 		wc.stack_mode = Below;
 		wc.sibling = m->barwin;
 		for (c = m->stack; c; c = c->snext)
 			if (!c->isfloating && ISVISIBLE(c)) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
+				backend->configure(c->win, CWSibling|CWStackMode, &wc);
 				wc.sibling = c->win;
 			}
 	}
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	backend->sync(1);
+}
+
+/* says what notify_say() held back while the hold helpers were starting,
+ * once they are ready or bootwait ms have passed */
+void
+releasespeech(unsigned long timedout)
+{
+	int i;
+
+	if (!holdspeech)
+		return;
+	if (timedout)
+		fprintf(stderr, "DINA: boot not done after %u ms, speaking anyway\n", bootwait);
+	holdspeech = 0;
+	for (i = 0; i < nheldspeech; i++) {
+		notify_say(heldspeech[i].rate, heldspeech[i].text);
+		free(heldspeech[i].text);
+	}
+	nheldspeech = 0;
+}
+
+void
+restart(const Arg *arg)
+{
+	restarting = 1;
+	running = 0;
+}
+
+/* apply a client's saved _DINA_STATE instead of the rules, see savestate() */
+int
+restoreclient(Client *c)
+{
+	Atom type;
+	int format;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	long *st;
+	Monitor *m;
+
+	if (!restoring)
+		return 0;
+	if (XGetWindowProperty(dpy, c->win, stateatom, 0L, CLIENTSTATE, True, XA_CARDINAL,
+		&type, &format, &n, &extra, &p) != Success || !p)
+		return 0;
+	if (n != CLIENTSTATE || !(((long *)p)[1] & TAGMASK)) {
+		XFree(p);
+		return 0;
+	}
+	st = (long *)p;
+	for (m = mons; m && m->num != st[0]; m = m->next);
+	c->mon = m ? m : selmon;
+	c->tags = st[1] & TAGMASK;
+	c->cold->order = st[2];
+	c->cold->stackorder = st[3];
+	c->isfloating = st[4] & 1;
+	if (c->isfloating) {
+		/* hidden windows sit off screen, their real spot is only saved here */
+		c->x = st[5];
+		c->y = st[6];
+		c->w = st[7];
+		c->h = st[8];
+	}
+	XFree(p);
+	return 1;
+}
+
+void
+restoremons(void)
+{
+	Atom type;
+	int format;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	long *st, *ms;
+	Monitor *m;
+
+	if (XGetWindowProperty(dpy, root, stateatom, 0L, 1 + 32 * MONSTATE, True, XA_CARDINAL,
+		&type, &format, &n, &extra, &p) != Success || !p)
+		return;
+	st = (long *)p;
+	for (m = mons; m; m = m->next) {
+		if (n < 1 + (m->num + 1) * MONSTATE)
+			break;
+		ms = st + 1 + m->num * MONSTATE;
+		if (!(ms[0] & TAGMASK) || !(ms[1] & TAGMASK)
+		|| ms[4] < 0 || ms[4] >= LENGTH(layouts) || ms[5] < 0 || ms[5] >= LENGTH(layouts))
+			continue;
+		m->tagset[0] = ms[0] & TAGMASK;
+		m->tagset[1] = ms[1] & TAGMASK;
+		m->seltags = ms[2] & 1;
+		m->sellt = ms[3] & 1;
+		m->lt[0] = &layouts[ms[4]];
+		m->lt[1] = &layouts[ms[5]];
+		m->nmaster = MAX(ms[6], 0);
+		m->mfact = ms[7] / 1000.0;
+		m->showbar = ms[8] & 1;
+		if (m->num == st[0])
+			selmon = m;
+	}
+	XFree(p);
+	for (m = mons; m; m = m->next)
+		updatebarpos(m);
+}
+
+/* manage() prepends, put every list back into its saved order */
+void
+restorestacks(void)
+{
+	Client *c, *n, **tc;
+	Monitor *m;
+
+	for (m = mons; m; m = m->next) {
+		for (c = m->clients, m->clients = NULL; c; c = n) {
+			n = c->next;
+			for (tc = &m->clients; *tc && (*tc)->cold->order < c->cold->order; tc = &(*tc)->next);
+			c->next = *tc;
+			*tc = c;
+		}
+		for (c = m->stack, m->stack = NULL; c; c = n) {
+			n = c->snext;
+			for (tc = &m->stack; *tc && (*tc)->cold->stackorder < c->cold->stackorder; tc = &(*tc)->snext);
+			c->snext = *tc;
+			*tc = c;
+		}
+		m->sel = NULL;
+		for (c = m->stack; c && !ISVISIBLE(c); c = c->snext);
+		m->sel = c;
+		XMoveWindow(dpy, m->barwin, m->wx, m->by);
+	}
+	restoring = 0;
+	arrange(NULL);
+	focus(NULL);
+	updateclientlist();
 }
 
 void
 run(void)
 {
 	XEvent ev;
+	struct pollfd fds[LENGTH(watches) + 1];
+	unsigned long long start = 0;
+	unsigned long request = 0;
+	long long t;
+	size_t i;
+	int j, n, timeout;
+
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	while (running) {
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			flight_record(FlightEvent, ev.type, ev.xany.window, NULL);
+			if (tracing) {
+				start = trace_now();
+				request = NextRequest(dpy);
+			}
+			if (ev.type < LASTEvent && handler[ev.type])
+				handler[ev.type](&ev); /* call handler */
+#ifdef XRANDR
+			else if (rrevbase && ev.type == rrevbase + RRScreenChangeNotify) {
+				XRRUpdateConfiguration(&ev);
+				if (!blackedout)
+					settimer(0, updatetopology, 0);
+			}
+#endif /* XRANDR */
+			if (tracing)
+				traceevent(&ev, start, request);
+		}
+		if (!running)
+			break;
+		fds[0].fd = ConnectionNumber(dpy);
+		fds[0].events = POLLIN;
+		for (n = 0; n < nwatches; n++) {
+			fds[n + 1].fd = watches[n].fd;
+			fds[n + 1].events = watches[n].events;
+		}
+		timeout = -1;
+		for (t = monotime(), i = 0; i < ntimers; i++)
+			if (timeout < 0 || timers[i].when - t < timeout)
+				timeout = MAX(timers[i].when - t, 0);
+		if (poll(fds, n + 1, timeout) < 0 && errno != EINTR)
+			die("DINA: poll:");
+		/* watches may be removed by earlier callbacks, look them up again */
+		for (i = 1; i <= n; i++)
+			if (fds[i].revents) {
+				for (j = 0; j < nwatches && watches[j].fd != fds[i].fd; j++);
+				if (j < nwatches)
+					watches[j].func(fds[i].fd, fds[i].revents);
+			}
+		runtimers();
+	}
+}
+
+void
+runtimers(void)
+{
+	Timer t;
+	size_t i;
+	long long now = monotime();
+
+	/* callbacks may add or cancel timers, so rescan after each one */
+	for (i = 0; i < ntimers;) {
+		if (timers[i].when > now) {
+			i++;
+			continue;
+		}
+		t = timers[i];
+		timers[i] = timers[--ntimers];
+		t.func(t.data);
+		i = 0;
+	}
+}
+
+/* leave monitors and clients on the X server for the restarted instance */
+void
+savestate(void)
+{
+	Client *c;
+	Monitor *m;
+	long *st, *ms, cs[CLIENTSTATE];
+	unsigned int i, n;
+
+	for (n = 0, m = mons; m; m = m->next, n++);
+	st = ecalloc(1 + n * MONSTATE, sizeof(long));
+	st[0] = selmon->num;
+	for (m = mons; m; m = m->next) {
+		ms = st + 1 + m->num * MONSTATE;
+		ms[0] = m->tagset[0];
+		ms[1] = m->tagset[1];
+		ms[2] = m->seltags;
+		ms[3] = m->sellt;
+		ms[4] = m->lt[0] - layouts;
+		ms[5] = m->lt[1] - layouts;
+		ms[6] = m->nmaster;
+		ms[7] = m->mfact * 1000;
+		ms[8] = m->showbar;
+		for (i = 0, c = m->clients; c; c = c->next)
+			c->cold->order = i++;
+		for (i = 0, c = m->stack; c; c = c->snext) {
+			cs[0] = m->num;
+			cs[1] = c->tags;
+			cs[2] = c->cold->order;
+			cs[3] = i++;
+			cs[4] = c->isfullscreen ? c->cold->oldstate : c->isfloating;
+			cs[5] = c->isfullscreen ? c->cold->oldx : c->x;
+			cs[6] = c->isfullscreen ? c->cold->oldy : c->y;
+			cs[7] = c->isfullscreen ? c->cold->oldw : c->w;
+			cs[8] = c->isfullscreen ? c->cold->oldh : c->h;
+			XChangeProperty(dpy, c->win, stateatom, XA_CARDINAL, 32,
+				PropModeReplace, (unsigned char *)cs, CLIENTSTATE);
+		}
+	}
+	XChangeProperty(dpy, root, stateatom, XA_CARDINAL, 32,
+		PropModeReplace, (unsigned char *)st, 1 + n * MONSTATE);
+	free(st);
 }
 
 void
@@ -1507,6 +3388,8 @@ scan(void)
 	Window d1, d2, *wins = NULL;
 	XWindowAttributes wa;
 
+	if (restoring)
+		restoremons();
 	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
 		for (i = 0; i < num; i++) {
 			if (!XGetWindowAttributes(dpy, wins[i], &wa)
@@ -1525,6 +3408,8 @@ scan(void)
 		if (wins)
 			XFree(wins);
 	}
+	if (restoring)
+		restorestacks();
 }
 
 void
@@ -1535,6 +3420,7 @@ sendmon(Client *c, Monitor *m)
 	unfocus(c, 1);
 	detach(c);
 	detachstack(c);
+	forgetsel(c->mon, c, ~0);
 	c->mon = m;
 	c->tags = m->tagset[m->seltags]; /* assign tags of target monitor */
 	attach(c);
@@ -1555,24 +3441,18 @@ setclientstate(Client *c, long state)
 int
 sendevent(Client *c, Atom proto)
 {
-	int n;
-	Atom *protocols;
-	int exists = 0;
+	int exists;
 	XEvent ev;
 
-	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
-		while (!exists && n--)
-			exists = protocols[n] == proto;
-		XFree(protocols);
-	}
-	if (exists) {
+	if ((exists = backend->hasprotocol(c->win, proto))) {
 		ev.type = ClientMessage;
 		ev.xclient.window = c->win;
 		ev.xclient.message_type = wmatom[WMProtocols];
 		ev.xclient.format = 32;
 		ev.xclient.data.l[0] = proto;
 		ev.xclient.data.l[1] = CurrentTime;
-		XSendEvent(dpy, c->win, False, NoEventMask, &ev);
+		ev.xclient.data.l[2] = c->win; /* echoed back by _NET_WM_PING */
+		backend->send(c->win, NoEventMask, &ev);
 	}
 	return exists;
 }
@@ -1581,10 +3461,8 @@ void
 setfocus(Client *c)
 {
 	if (!c->neverfocus) {
-		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-		XChangeProperty(dpy, root, netatom[NetActiveWindow],
-			XA_WINDOW, 32, PropModeReplace,
-			(unsigned char *) &(c->win), 1);
+		backend->focus(c->win);
+		backend->setprop(root, netatom[NetActiveWindow], XA_WINDOW, &c->win, 1);
 	}
 	sendevent(c, wmatom[WMTakeFocus]);
 }
@@ -1596,8 +3474,8 @@ setfullscreen(Client *c, int fullscreen)
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)&netatom[NetWMFullscreen], 1);
 		c->isfullscreen = 1;
-		c->oldstate = c->isfloating;
-		c->oldbw = c->bw;
+		c->cold->oldstate = c->isfloating;
+		c->cold->oldbw = c->bw;
 		c->bw = 0;
 		c->isfloating = 1;
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
@@ -1606,12 +3484,12 @@ setfullscreen(Client *c, int fullscreen)
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)0, 0);
 		c->isfullscreen = 0;
-		c->isfloating = c->oldstate;
-		c->bw = c->oldbw;
-		c->x = c->oldx;
-		c->y = c->oldy;
-		c->w = c->oldw;
-		c->h = c->oldh;
+		c->isfloating = c->cold->oldstate;
+		c->bw = c->cold->oldbw;
+		c->x = c->cold->oldx;
+		c->y = c->cold->oldy;
+		c->w = c->cold->oldw;
+		c->h = c->cold->oldh;
 		resizeclient(c, c->x, c->y, c->w, c->h);
 		arrange(c->mon);
 	}
@@ -1646,26 +3524,158 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+/* (re)arm the timer identified by func and data to fire in ms milliseconds */
+void
+settimer(long ms, void (*func)(unsigned long), unsigned long data)
+{
+	size_t i;
+
+	for (i = 0; i < ntimers && (timers[i].func != func || timers[i].data != data); i++);
+	if (i == ntimers) {
+		if (ntimers == timerscap) {
+			timerscap = timerscap ? timerscap * 2 : 8;
+			if (!(timers = realloc(timers, timerscap * sizeof(Timer))))
+				die("realloc:");
+		}
+		ntimers++;
+	}
+	timers[i].when = monotime() + ms;
+	timers[i].func = func;
+	timers[i].data = data;
+}
+
+/* Switches every CRTC off, remembering its configuration, or back on exactly
+ * as it was.  The server is grabbed so clients see a single change, and the
+ * monitors DINA knows stay as they are meanwhile, so nothing is rearranged.
+ * Returns how many CRTCs could not be changed, or -1 without RandR 1.3. */
+int
+setblackout(int off)
+{
+#ifdef XRANDR
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci;
+	int i, minw, minh, maxw, maxh, failed = 0;
+
+	if (rrversion < 103 || off == blackedout)
+		return rrversion < 103 ? -1 : 0;
+	XGrabServer(dpy);
+	if (!(res = XRRGetScreenResourcesCurrent(dpy, root))) {
+		XUngrabServer(dpy);
+		return -1;
+	}
+	if (off) {
+		blackw = sw;
+		blackh = sh;
+		blackmmw = DisplayWidthMM(dpy, screen);
+		blackmmh = DisplayHeightMM(dpy, screen);
+		blackcrtcs = ecalloc(res->ncrtc, sizeof(SavedCrtc));
+		for (i = 0; i < res->ncrtc; i++) {
+			if (!(ci = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+				continue;
+			if (ci->mode == None) {
+				XRRFreeCrtcInfo(ci);
+				continue;
+			}
+			if (XRRSetCrtcConfig(dpy, res, res->crtcs[i], CurrentTime,
+			    0, 0, None, RR_Rotate_0, NULL, 0) != RRSetConfigSuccess) {
+				XRRFreeCrtcInfo(ci);
+				failed++;
+				continue;
+			}
+			blackcrtcs[nblackcrtcs].crtc = res->crtcs[i];
+			blackcrtcs[nblackcrtcs++].info = ci;
+		}
+		/* with nothing scanned out, the smallest framebuffer saves memory
+		 * bandwidth and power */
+		if (blackoutlowpower && nblackcrtcs && blackw > 0 && blackh > 0
+		&& XRRGetScreenSizeRange(dpy, root, &minw, &minh, &maxw, &maxh))
+			XRRSetScreenSize(dpy, root, minw, minh,
+				MAX(1, blackmmw * minw / blackw), MAX(1, blackmmh * minh / blackh));
+		blackedout = nblackcrtcs > 0;
+	} else {
+		if (blackoutlowpower)
+			XRRSetScreenSize(dpy, root, blackw, blackh, blackmmw, blackmmh);
+		for (i = 0; i < nblackcrtcs; i++) {
+			ci = blackcrtcs[i].info;
+			/* fails if the output went away meanwhile; the topology
+			 * update below takes care of that */
+			if (XRRSetCrtcConfig(dpy, res, blackcrtcs[i].crtc, CurrentTime,
+			    ci->x, ci->y, ci->mode, ci->rotation, ci->outputs, ci->noutput)
+			    != RRSetConfigSuccess)
+				failed++;
+			XRRFreeCrtcInfo(ci);
+		}
+		nblackcrtcs = 0;
+		blackedout = 0;
+	}
+	if (!blackedout) {
+		free(blackcrtcs);
+		blackcrtcs = NULL;
+	}
+	XRRFreeScreenResources(res);
+	XUngrabServer(dpy);
+	XSync(dpy, False);
+	if (!blackedout)
+		settimer(0, updatetopology, 0);
+	return failed;
+#else
+	return -1;
+#endif /* XRANDR */
+}
+
 void
 setup(void)
 {
-	int i;
+	int i, j;
 	XSetWindowAttributes wa;
-	Atom utf8string;
+	Atom utf8string, atoms[WMLast + NetLast + 2];
+	char *atomnames[WMLast + NetLast + 2];
+	static char crashstack[65536]; /* SIGSTKSZ need not be a constant */
+	const int crashsigs[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+	const char *home = getenv("HOME");
+	char path[PATH_MAX];
+	stack_t ss;
 	struct sigaction sa;
+#ifdef XRANDR
+	int rrerrbase, rrmajor, rrminor;
+#endif /* XRANDR */
 	
 	/* Load application persistence data */
 	loadapptagpersist();
+	compilerules();
 
-	/* do not transform children into zombies when they terminate */
+	/* helpers are reaped through their pidfds, see helperexit(), and
+	 * spawn() leaves nothing to reap, so SIGCHLD is not ignored */
 	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
-	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = 0;
+	sa.sa_handler = SIG_DFL;
 	sigaction(SIGCHLD, &sa, NULL);
 
 	/* clean up any zombies (inherited from .xinitrc etc) immediately */
 	while (waitpid(-1, NULL, WNOHANG) > 0);
 
+	/* control socket clients may hang up before reading their reply */
+	sa.sa_flags = 0;
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	/* a crash writes the flight recorder out first, on a stack of its own
+	 * in case the crash was an overflow of the normal one */
+	if (home) {
+		snprintf(path, sizeof path, "%s/.local/share/DINA", home);
+		mkdir(path, 0755);
+		snprintf(path, sizeof path, "%s/%s", home, FLIGHT_LOG_FILE);
+		flight_init(path);
+	}
+	ss.ss_sp = crashstack;
+	ss.ss_size = sizeof crashstack;
+	ss.ss_flags = 0;
+	sigaltstack(&ss, NULL);
+	sa.sa_flags = SA_ONSTACK | SA_RESETHAND;
+	sa.sa_handler = crash;
+	for (i = 0; i < LENGTH(crashsigs); i++)
+		sigaction(crashsigs[i], &sa, NULL);
+
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
@@ -1676,30 +3686,35 @@ setup(void)
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
 	bh = drw->fonts->h + 2;
+#ifdef XRANDR
+	/* monitors (RandR 1.5) replace Xinerama and report topology changes */
+	if (XRRQueryExtension(dpy, &rrevbase, &rrerrbase)
+	&& XRRQueryVersion(dpy, &rrmajor, &rrminor))
+		rrversion = rrmajor * 100 + rrminor;
+	if (rrversion >= 105)
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask);
+	else
+		rrevbase = 0;
+#endif /* XRANDR */
 	updategeom();
-	/* init atoms */
-	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
-	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
-	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
-	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
-	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
-	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", False);
-	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
-	netatom[NetWMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
-	/* init cursors */
-	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr);
-	cursor[CurResize] = drw_cur_create(drw, XC_sizing);
-	cursor[CurMove] = drw_cur_create(drw, XC_fleur);
-	/* init appearance */
+	/* init atoms, all in a single round trip */
+	memcpy(atomnames, wmatomnames, sizeof wmatomnames);
+	memcpy(atomnames + WMLast, netatomnames, sizeof netatomnames);
+	atomnames[WMLast + NetLast] = "UTF8_STRING";
+	atomnames[WMLast + NetLast + 1] = "_DINA_STATE";
+	XInternAtoms(dpy, atomnames, LENGTH(atomnames), False, atoms);
+	memcpy(wmatom, atoms, sizeof wmatom);
+	memcpy(netatom, atoms + WMLast, sizeof netatom);
+	utf8string = atoms[WMLast + NetLast];
+	stateatom = atoms[WMLast + NetLast + 1];
+	/* init appearance, identical schemes are allocated once */
 	scheme = ecalloc(LENGTH(colors), sizeof(Clr *));
-	for (i = 0; i < LENGTH(colors); i++)
-		scheme[i] = drw_scm_create(drw, colors[i], 3);
+	for (i = 0; i < LENGTH(colors); i++) {
+		for (j = 0; j < i && (strcmp(colors[i][ColFg], colors[j][ColFg])
+		|| strcmp(colors[i][ColBg], colors[j][ColBg])
+		|| strcmp(colors[i][ColBorder], colors[j][ColBorder])); j++);
+		scheme[i] = j < i ? scheme[j] : drw_scm_create(drw, colors[i], 3);
+	}
 	/* init bars */
 	updatebars();
 	updatestatus();
@@ -1715,172 +3730,394 @@ setup(void)
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char *) netatom, NetLast);
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	/* select events */
-	wa.cursor = cursor[CurNormal]->cursor;
+	/* select events; cursors are only needed once the mouse is used */
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
 		|ButtonPressMask|PointerMotionMask|EnterWindowMask
 		|LeaveWindowMask|StructureNotifyMask|PropertyChangeMask;
-	XChangeWindowAttributes(dpy, root, CWEventMask|CWCursor, &wa);
+	XChangeWindowAttributes(dpy, root, CWEventMask, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
 	grabkeys();
 	focus(NULL);
+	setupctl();
+	psisetup();
+	settimer(pinginterval, pingsel, 0);
+}
+
+void
+setupctl(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	sockpath(addr.sun_path, sizeof addr.sun_path, "dina");
+	unlink(addr.sun_path);
+	if ((ctlfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+	|| bind(ctlfd, (struct sockaddr *)&addr, sizeof addr) < 0
+	|| chmod(addr.sun_path, 0600) < 0
+	|| listen(ctlfd, 4) < 0) {
+		fprintf(stderr, "DINA: control socket %s: %s\n", addr.sun_path, strerror(errno));
+		if (ctlfd >= 0)
+			close(ctlfd);
+		ctlfd = -1;
+		return;
+	}
+	fcntl(ctlfd, F_SETFD, FD_CLOEXEC);
+	fcntl(ctlfd, F_SETFL, O_NONBLOCK);
+	addwatch(ctlfd, POLLIN, ctlaccept);
+}
+
+void
+seturgent(Client *c, int urg)
+{
+	c->isurgent = urg;
+	backend->seturgent(c->win, urg);
+}
+
+void
+showhide(Client *c)
+{
+	if (!c)
+		return;
+	if (ISVISIBLE(c)) {
+		/* show clients top down */
+		backend->move(c->win, c->x, c->y);
+		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
+			resize(c, c->x, c->y, c->w, c->h, 0);
+		showhide(c->snext);
+	} else {
+		/* hide clients bottom up */
+		showhide(c->snext);
+		backend->move(c->win, WIDTH(c) * -2, c->y);
+	}
+}
+
+/* Stage 0 ends the shutdown once no window is left.  Stage 1 is the
+ * deadline: the windows still open are announced and closed like
+ * unresponsive ones, and stage 2 exits once that had its time. */
+void
+shutdownstep(unsigned long stage)
+{
+	Monitor *m;
+	Client *c;
+	char text[512];
+	size_t n = 0;
+	int left = 0;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (left++ < 8 && n < sizeof text)
+				n += snprintf(text + n, sizeof text - n, "%s%s", n ? ", " : "", c->cold->name);
+	if (!left || stage == 2) {
+		running = 0;
+		return;
+	}
+	if (stage == 0)
+		return;
+	if (left > 8 && n < sizeof text)
+		n += snprintf(text + n, sizeof text - n, " and %d more", left - 8);
+	if (n < sizeof text)
+		snprintf(text + n, sizeof text - n, " still open, closing anyway");
+	notify_say("-40", text);
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			c->closing = 1; /* so killescalate() terminates the process too */
+			killescalate(c->win);
+		}
+	settimer(killtimeout + 500, shutdownstep, 2);
+}
+
+void
+sockpath(char *buf, size_t len, const char *name)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	const char *display = getenv("DISPLAY");
+
+	if (!display)
+		display = "";
+	if (dir && *dir)
+		snprintf(buf, len, "%s/%s%s.sock", dir, name, display);
+	else
+		snprintf(buf, len, "/tmp/%s-%d%s.sock", name, (int)getuid(), display);
+}
+
+void
+spawn(const Arg *arg)
+{
+	const char **argv = (const char **)arg->v;
+	pid_t pid;
+
+	if (arg->v == dmenucmd)
+		dmenumon[0] = '0' + selmon->num;
+	pid = backend->spawn(argv);
+	/* a shell command is recorded by its script */
+	flight_record(FlightSpawn, pid, 0, !strcmp(argv[0], "/bin/sh") && argv[1] && argv[2] ? argv[2] : argv[0]);
+}
+
+/* text may come from a client (titles), so it goes to spd-say as one
+ * argument and never through a shell; spd-say also starts
+ * speech-dispatcher, so the next announcement connects, which is only
+ * wanted when DINA does not supervise one itself */
+int
+spdsay(const char *rate, const char *text)
+{
+	Arg arg = { .v = (const char*[]){ "spd-say", "-r", rate, "--", text, NULL } };
+	int i;
+
+	for (i = 0; i < nsupervised; i++)
+		if (supervised[i].helper->ready == ReadySpeech && !supervised[i].gaveup
+		&& !supervised[i].external)
+			return -1;
+	spawn(&arg);
+	return 0;
+}
+
+/* speaks text now, held back or not, see notify_say(), through the first
+ * voice not skipped after failing */
+void
+speak(const char *rate, const char *text)
+{
+	long long now = monotime();
+	int i;
 
-	/* Autostart Orca screen reader for accessibility */
-	const char *home = getenv("HOME");
-	if (home) {
-		struct stat st;
-		/* First check if start-orca exists in standard location */
-		char orcapath[256] = {0};
-		char autostart_file[256] = {0};
-		
-		/* Create locations to check for the start-orca script */
-		char paths_to_check[5][256];
-		int paths_count = 0;
-		
-		/* 1. Check user's local bin directory */
-		snprintf(paths_to_check[paths_count++], 256, "%s/.local/bin/start-orca", home);
-		/* 2. Check system bin directory */
-		snprintf(paths_to_check[paths_count++], 256, "/usr/bin/start-orca");
-		/* 3. Check DINA scripts directory relative to executable */
-		char selfpath[256] = {0};
-		ssize_t len = readlink("/proc/self/exe", selfpath, sizeof(selfpath) - 1);
-		if (len > 0) {
-			char *last_slash = strrchr(selfpath, '/');
-			if (last_slash) {
-				*last_slash = '\0'; /* cut off executable name */
-				snprintf(paths_to_check[paths_count++], 256, "%s/scripts/start-orca", selfpath);
-			}
-		}
-		/* 4. Check directly in scripts directory of repo */
-		snprintf(paths_to_check[paths_count++], 256, "%s/Documents/GitHub/DINA/scripts/start-orca", home);
-		/* 5. Check common install locations */
-		snprintf(paths_to_check[paths_count++], 256, "/usr/local/bin/start-orca");
-		
-		/* Find the first valid path */
-		for (int i = 0; i < paths_count; i++) {
-			if (access(paths_to_check[i], X_OK) == 0) {
-				strncpy(orcapath, paths_to_check[i], sizeof(orcapath) - 1);
-				break;
-			}
-		}
-		
-		/* Create autostart directory if it doesn't exist */
-		snprintf(autostart_file, sizeof(autostart_file), "%s/.config/autostart", home);
-		if (stat(autostart_file, &st) == -1) {
-			mkdir(autostart_file, 0755);
-		}
-		
-		/* Launch the screen reader if we found it */
-		if (orcapath[0] != '\0') {
-			Arg arg = {0};
-			char *orcacmd[] = { orcapath, NULL };
-			arg.v = orcacmd;
-			spawn(&arg);
-			
-			/* Also create desktop entry for future sessions */
-			snprintf(autostart_file, sizeof(autostart_file), "%s/.config/autostart/orca-screen-reader.desktop", home);
-			FILE *desktop_file = fopen(autostart_file, "w");
-			if (desktop_file) {
-				fprintf(desktop_file, 
-					"[Desktop Entry]\n"
-					"Type=Application\n"
-					"Name=Orca Screen Reader\n"
-					"Comment=Start Orca screen reader with DINA\n"
-					"Exec=%s\n"
-					"Terminal=false\n"
-					"X-GNOME-Autostart-enabled=true\n"
-					"X-GNOME-Autostart-Phase=WindowManager\n"
-					"NoDisplay=false\n", orcapath);
-				fclose(desktop_file);
-				chmod(autostart_file, 0755);
-			}
+	for (i = 0; i < LENGTH(voices); i++) {
+		if (voices[i].downuntil > now)
+			continue;
+		if (!voices[i].say(rate, text)) {
+			voices[i].spoken++;
+			return;
 		}
+		voices[i].failed++;
 	}
-	
-	/* Play startup sound to indicate DINA has started successfully */
-	notify_startup();
 }
 
-void
-seturgent(Client *c, int urg)
+/* speakcmd with text appended, at its own rate */
+int
+speakcmdsay(const char *rate, const char *text)
 {
-	XWMHints *wmh;
+	const char *argv[LENGTH(speakcmd) + 1];
+	Arg arg = { .v = argv };
+	size_t i;
 
-	c->isurgent = urg;
-	if (!(wmh = XGetWMHints(dpy, c->win)))
-		return;
-	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
-	XSetWMHints(dpy, c->win, wmh);
-	XFree(wmh);
+	for (i = 0; speakcmd[i]; i++)
+		argv[i] = speakcmd[i];
+	argv[i++] = text;
+	argv[i] = NULL;
+	spawn(&arg);
+	return 0;
 }
 
+/* speech-dispatcher took speechtimeout ms without answering: it is skipped
+ * for speechretry ms and the next voice says the last message again */
 void
-showhide(Client *c)
+speechcheck(unsigned long data)
 {
-	if (!c)
+	if (!speechsent || monotime() - speechsent < speechtimeout)
 		return;
-	if (ISVISIBLE(c)) {
-		/* show clients top down */
-		XMoveWindow(dpy, c->win, c->x, c->y);
-		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
-			resize(c, c->x, c->y, c->w, c->h, 0);
-		showhide(c->snext);
-	} else {
-		/* hide clients bottom up */
-		showhide(c->snext);
-		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
-	}
+	fprintf(stderr, "DINA: speech-dispatcher did not answer in %u ms\n", speechtimeout);
+	speechclose();
+	voices[0].failed++;
+	voices[0].downuntil = monotime() + speechretry;
+	if (speechlast.text)
+		speak(speechlast.rate, speechlast.text);
 }
 
 void
-spawn(const Arg *arg)
+speechclose(void)
 {
-	struct sigaction sa;
+	delwatch(speechfd);
+	close(speechfd);
+	speechfd = -1;
+	speechsent = 0;
+}
 
-	if (arg->v == dmenucmd)
-		dmenumon[0] = '0' + selmon->num;
-	if (fork() == 0) {
-		if (dpy)
-			close(ConnectionNumber(dpy));
-		setsid();
+/* drains replies from speech-dispatcher; it hanging up just means the
+ * next announcement reconnects */
+void
+speechevent(int fd, short revents)
+{
+	char buf[512];
+	ssize_t n;
 
-		sigemptyset(&sa.sa_mask);
-		sa.sa_flags = 0;
-		sa.sa_handler = SIG_DFL;
-		sigaction(SIGCHLD, &sa, NULL);
+	while ((n = read(fd, buf, sizeof buf)) > 0)
+		speechsent = 0;
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || revents & (POLLHUP | POLLERR))
+		speechclose();
+}
+
+/* writes to speech-dispatcher, connecting first if needed, and has
+ * speechcheck() look for its answer */
+int
+ssipsay(const char *rate, const char *text)
+{
+	char *copy;
 
-		execvp(((char **)arg->v)[0], (char **)arg->v);
-		die("DINA: execvp '%s' failed:", ((char **)arg->v)[0]);
+	if (speechfd < 0 && (speechfd = speech_open()) >= 0)
+		addwatch(speechfd, POLLIN, speechevent);
+	if (speechfd < 0)
+		return -1;
+	if (speech_say(speechfd, rate, text, speechtimeout) < 0) {
+		speechclose();
+		return -1;
 	}
+	if ((copy = strdup(text))) {
+		free(speechlast.text);
+		speechlast.text = copy;
+		snprintf(speechlast.rate, sizeof speechlast.rate, "%s", rate);
+	}
+	if (!speechsent) {
+		speechsent = monotime();
+		settimer(speechtimeout, speechcheck, 0);
+	}
+	return 0;
 }
 
 void
 notify_window_untracked(const char *class, const char *instance)
 {
-	char cmd[512];
-	char app_name[512];
-	
-	/* Use instance as app name, or class if instance is "broken" */
-	if (strcmp(instance, broken) == 0)
-		strncpy(app_name, class, sizeof(app_name) - 1);
-	else
-		strncpy(app_name, instance, sizeof(app_name) - 1);
+	char text[600];
 	
-	/* Create notification command */
-	snprintf(cmd, sizeof(cmd), 
-		"play -nq synth 0.1 sine 600 sine 400 vol 0.3 & spd-say -r -40 \"%s no longer tracked\"", 
-		app_name);
+	/* Use instance as app name, or class if instance is "broken";
+	 * both come from the client, so only the tone goes through a shell */
+	snprintf(text, sizeof(text), "%.512s no longer tracked",
+		strcmp(instance, broken) == 0 ? class : instance);
 	
-	Arg arg = SHCMD_NOTIFY(cmd);
+	Arg arg = SHCMD_NOTIFY("play -nq synth 0.1 sine 600 sine 400 vol 0.3");
+	spawn(&arg);
+	notify_say("-40", text);
+}
+
+/* the session boot, see supervisesetup(); kept out of setup() so
+ * bench/wm-replay can set up the core without starting helpers */
+void
+startsession(void)
+{
+	Arg arg = { .v = launchercmd };
+
+	supervisesetup();
+
+	/* a restart replaces the running instance, nothing to announce or start */
+	if (restoring)
+		return;
+
+	/* Play startup sound to indicate DINA has started successfully */
+	notify_startup();
+
+	/* the launcher builds its window now so Super+a only has to map it */
 	spawn(&arg);
 }
 
+void
+startupmark(int phase)
+{
+	clock_gettime(CLOCK_MONOTONIC, &startup[phase]);
+}
+
+/* milliseconds from entering main() to the end of the given startup phase */
+double
+startupms(int phase)
+{
+	return (startup[phase].tv_sec - startup[StartMain].tv_sec) * 1e3
+		+ (startup[phase].tv_nsec - startup[StartMain].tv_nsec) / 1e6;
+}
+
+/* adds a helper, taking over the running process adopt if nonzero;
+ * bootstep() starts the others */
+Supervised *
+supervise(const Helper *h, pid_t adopt)
+{
+	Supervised *s;
+	int fd;
+
+	if (nsupervised == LENGTH(supervised)) {
+		fprintf(stderr, "DINA: too many helpers, not starting %s\n", h->name);
+		return NULL;
+	}
+	s = &supervised[nsupervised++];
+	s->helper = h;
+	s->pidfd = -1;
+	if (adopt > 0 && (fd = syscall(SYS_pidfd_open, adopt, 0)) >= 0) {
+		s->pid = adopt;
+		s->pidfd = fd;
+		s->started = s->booted = s->readyat = monotime();
+		s->readyhow = "adopted";
+		addwatch(fd, POLLIN, helperexit);
+	}
+	return s;
+}
+
+/* A restart leaves the helpers running for the next instance, which takes
+ * them over through $DINA_HELPERS; quitting terminates them. */
+void
+supervisecleanup(void)
+{
+	Supervised *s;
+	char env[512] = "";
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i < nsupervised; i++) {
+		s = &supervised[i];
+		if (s->pidfd >= 0)
+			close(s->pidfd);
+		if (!s->pid)
+			continue;
+		if (!restarting)
+			kill(-s->pid, SIGTERM); /* its session, see helperstart() */
+		else if (n < sizeof env)
+			n += snprintf(env + n, sizeof env - n, "%s%s:%d:%lld:%u", n ? " " : "",
+				s->helper->name, (int)s->pid, s->started, s->restarts);
+	}
+	if (restarting && n < sizeof env)
+		setenv("DINA_HELPERS", env, 1);
+}
+
+/* Boots helpers[], or takes over what the instance before a restart left
+ * running and starts the rest.  Announcements are held for the hold
+ * helpers, but at most bootwait ms. */
+void
+supervisesetup(void)
+{
+	const char *env = restoring ? getenv("DINA_HELPERS") : NULL, *p;
+	Supervised *s;
+	char name[64];
+	long long started;
+	unsigned int restarts;
+	size_t i;
+	pid_t adopt;
+	int pid, n;
+
+	findorca(orcapath, sizeof orcapath);
+	booting = !restoring;
+	for (i = 0; i < LENGTH(helpers); i++) {
+		if (!helpers[i].cmd[0] || !helpers[i].cmd[0][0])
+			continue;
+		adopt = 0;
+		for (p = env; p && sscanf(p, " %63[^:]:%d:%lld:%u%n", name, &pid, &started, &restarts, &n) == 4; p += n)
+			if (!strcmp(name, helpers[i].name)) {
+				adopt = pid;
+				break;
+			}
+		if ((s = supervise(&helpers[i], adopt)) && adopt && s->pid == adopt) {
+			s->started = started;
+			s->restarts = restarts;
+		}
+	}
+	unsetenv("DINA_HELPERS");
+	for (i = 0; booting && i < (size_t)nsupervised; i++)
+		if (supervised[i].helper->hold) {
+			holdspeech = 1;
+			settimer(bootwait, releasespeech, 1);
+			break;
+		}
+	bootstep();
+}
+
 void
 tag(const Arg *arg)
 {
 	if (selmon->sel && arg->ui & TAGMASK) {
 		unsigned int oldtags = selmon->sel->tags;
 		selmon->sel->tags = arg->ui & TAGMASK;
+		forgetsel(selmon, selmon->sel, ~selmon->sel->tags);
 		
 		// Calculate tag numbers for notification
 		// Find the first (lowest) tag in the mask
@@ -1901,31 +4138,26 @@ tag(const Arg *arg)
 		// Only notify if the tag actually changed
 		if (oldtags != selmon->sel->tags) {
 			notify_window_move(from_tag, to_tag);
+		}
+		
+		// Windows without WM_CLASS are not remembered
+		if (oldtags != selmon->sel->tags && selmon->sel->cold->hasclass) {
+			// Class and instance are cached on the client, see updateclass()
+			const char *class = selmon->sel->cold->class;
+			const char *instance = selmon->sel->cold->instance;
+			
+			// Check if we're removing a tracked application
+			int was_tracked = -1;
+			if (to_tag == 1) {
+				was_tracked = findapptagpersist(class, instance, selmon->sel->cold->classhash);
+			}
+			
+			// Store or remove tag preference for this application
+			updateapptagpersist(class, instance, to_tag);
 			
-			// Get window class and instance for persistence
-			XClassHint ch = { NULL, NULL };
-			if (XGetClassHint(dpy, selmon->sel->win, &ch)) {
-				const char *class = ch.res_class ? ch.res_class : broken;
-				const char *instance = ch.res_name ? ch.res_name : broken;
-				
-				// Check if we're removing a tracked application
-				int was_tracked = -1;
-				if (to_tag == 1) {
-					was_tracked = findapptagpersist(class, instance);
-				}
-				
-				// Store or remove tag preference for this application
-				updateapptagpersist(class, instance, to_tag);
-				
-				// Notify if we untracked an application
-				if (to_tag == 1 && was_tracked >= 0) {
-					notify_window_untracked(class, instance);
-				}
-				
-				if (ch.res_class)
-					XFree(ch.res_class);
-				if (ch.res_name)
-					XFree(ch.res_name);
+			// Notify if we untracked an application
+			if (to_tag == 1 && was_tracked >= 0) {
+				notify_window_untracked(class, instance);
 			}
 		}
 		
@@ -2020,29 +4252,131 @@ toggleview(const Arg *arg)
 	}
 }
 
+/* Window records for the clients managed before the trace started, so
+ * the replay has them too */
+void
+traceclients(void)
+{
+	Monitor *m;
+	Client *c;
+	Window trans;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			tracewindow(c, XGetTransientForHint(dpy, c->win, &trans) ? trans : None);
+}
+
+/* e was handled, taking since start microseconds and the requests from
+ * request on */
+void
+traceevent(XEvent *e, unsigned long long start, unsigned long request)
+{
+	TracedEvent t = { 0 };
+
+	t.type = e->type;
+	t.window = e->xany.window;
+	t.us = trace_now() - start;
+	t.requests = NextRequest(dpy) - request;
+	switch (e->type) {
+	case ConfigureRequest:
+		t.window = e->xconfigurerequest.window;
+		t.mask = e->xconfigurerequest.value_mask;
+		t.x = e->xconfigurerequest.x;
+		t.y = e->xconfigurerequest.y;
+		t.w = e->xconfigurerequest.width;
+		t.h = e->xconfigurerequest.height;
+		t.bw = e->xconfigurerequest.border_width;
+		break;
+	case DestroyNotify:
+		t.window = e->xdestroywindow.window;
+		break;
+	case MapRequest:
+		t.window = e->xmaprequest.window;
+		break;
+	case PropertyNotify:
+		if (e->xproperty.atom == XA_WM_NAME || e->xproperty.atom == netatom[NetWMName])
+			t.detail = TracePropName;
+		else if (e->xproperty.atom == XA_WM_HINTS)
+			t.detail = TracePropHints;
+		else if (e->xproperty.atom == XA_WM_NORMAL_HINTS)
+			t.detail = TracePropNormalHints;
+		else if (e->xproperty.atom == XA_WM_TRANSIENT_FOR)
+			t.detail = TracePropTransient;
+		else if (e->xproperty.atom == netatom[NetWMWindowType])
+			t.detail = TracePropType;
+		break;
+	case UnmapNotify:
+		t.window = e->xunmap.window;
+		t.detail = e->xunmap.send_event;
+		break;
+	}
+	trace_record(TraceEvent, &t, sizeof t, NULL, 0);
+}
+
+void
+tracetitle(Client *c)
+{
+	trace_record(TraceTitle, &(TracedTitle){ c->win }, sizeof(TracedTitle),
+		(const char *[]){ c->cold->name }, 1);
+}
+
+void
+tracewindow(Client *c, Window trans)
+{
+	TracedWindow t = { 0 };
+
+	t.window = c->win;
+	t.transient = trans;
+	t.x = c->x;
+	t.y = c->y;
+	t.w = c->w;
+	t.h = c->h;
+	t.fixed = c->isfixed;
+	t.dialog = c->isfloating && trans == None && !c->isfixed;
+	trace_record(TraceWindow, &t, sizeof t,
+		(const char *[]){ c->cold->class, c->cold->instance, c->cold->name }, 3);
+}
+
 void
 unfocus(Client *c, int setfocus)
 {
 	if (!c)
 		return;
 	grabbuttons(c, 0);
-	XSetWindowBorder(dpy, c->win, scheme[SchemeNorm][ColBorder].pixel);
+	backend->border(c->win, scheme[SchemeNorm][ColBorder].pixel);
 	if (setfocus) {
-		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		backend->focus(root);
+		backend->delprop(root, netatom[NetActiveWindow]);
 	}
 }
 
+void
+unintern(const char *s)
+{
+	Str *str, **sp;
+
+	if (!s)
+		return;
+	str = (Str *)(s - offsetof(Str, s));
+	if (--str->refs)
+		return;
+	for (sp = &strtab[str->hash % LENGTH(strtab)]; *sp != str; sp = &(*sp)->next);
+	*sp = str->next;
+	free(str);
+}
+
 void
 unmanage(Client *c, int destroyed)
 {
 	Monitor *m = c->mon;
 	XWindowChanges wc;
 
+	flight_record(FlightUnmanage, destroyed, c->win, c->cold->class);
 	detach(c);
 	detachstack(c);
+	forgetsel(m, c, ~0);
 	if (!destroyed) {
-		wc.border_width = c->oldbw;
+		wc.border_width = c->cold->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
 		XSetErrorHandler(xerrordummy);
 		XSelectInput(dpy, c->win, NoEventMask);
@@ -2053,10 +4387,12 @@ unmanage(Client *c, int destroyed)
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
-	free(c);
+	freeclient(c);
 	focus(NULL);
 	updateclientlist();
 	arrange(m);
+	if (shuttingdown)
+		settimer(0, shutdownstep, 0);
 }
 
 void
@@ -2089,7 +4425,6 @@ updatebars(void)
 		m->barwin = XCreateWindow(dpy, root, m->wx, m->by, m->ww, bh, 0, DefaultDepth(dpy, screen),
 				CopyFromParent, DefaultVisual(dpy, screen),
 				CWOverrideRedirect|CWBackPixmap|CWEventMask, &wa);
-		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
 	}
@@ -2108,6 +4443,25 @@ updatebarpos(Monitor *m)
 		m->by = -bh;
 }
 
+void
+updateclass(Client *c)
+{
+	XClassHint ch = { NULL, NULL };
+	const char *class = c->cold->class, *instance = c->cold->instance;
+
+	c->cold->hasclass = XGetClassHint(dpy, c->win, &ch) != 0;
+	c->cold->class    = intern(ch.res_class ? ch.res_class : broken);
+	c->cold->instance = intern(ch.res_name  ? ch.res_name  : broken);
+	c->cold->classhash = persist_hash(c->cold->class, strlen(c->cold->class),
+		c->cold->instance, strlen(c->cold->instance));
+	unintern(class);
+	unintern(instance);
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+}
+
 void
 updateclientlist(void)
 {
@@ -2122,77 +4476,74 @@ updateclientlist(void)
 				(unsigned char *) &(c->win), 1);
 }
 
+/* Diff the monitor topology against the current one. Monitors whose geometry
+ * did not change are left alone, the others are marked dirty; clients only
+ * move when their monitor disappears. Returns the number of dirty monitors. */
 int
 updategeom(void)
 {
-	int dirty = 0;
-
-#ifdef XINERAMA
-	if (XineramaIsActive(dpy)) {
-		int i, j, n, nn;
-		Client *c;
-		Monitor *m;
-		XineramaScreenInfo *info = XineramaQueryScreens(dpy, &nn);
-		XineramaScreenInfo *unique = NULL;
-
-		for (n = 0, m = mons; m; m = m->next, n++);
-		/* only consider unique geometries as separate screens */
-		unique = ecalloc(nn, sizeof(XineramaScreenInfo));
-		for (i = 0, j = 0; i < nn; i++)
-			if (isuniquegeom(unique, j, &info[i]))
-				memcpy(&unique[j++], &info[i], sizeof(XineramaScreenInfo));
-		XFree(info);
-		nn = j;
-
-		/* new monitors if nn > n */
-		for (i = n; i < nn; i++) {
-			for (m = mons; m && m->next; m = m->next);
-			if (m)
-				m->next = createmon();
-			else
-				mons = createmon();
-		}
-		for (i = 0, m = mons; i < nn && m; m = m->next, i++)
-			if (i >= n
-			|| unique[i].x_org != m->mx || unique[i].y_org != m->my
-			|| unique[i].width != m->mw || unique[i].height != m->mh)
-			{
-				dirty = 1;
+	int i, n, dirty = 0;
+	Client *c;
+	Monitor *m, *next, **slot;
+	MonGeom *g;
+
+	if (!(n = getmongeoms(&g))) { /* default monitor setup */
+		g = ecalloc(1, sizeof(MonGeom));
+		g->w = sw;
+		g->h = sh;
+		n = 1;
+	}
+	slot = ecalloc(n, sizeof(Monitor *));
+	for (m = mons; m; m = m->next)
+		m->num = -1;
+	/* monitors with an unchanged geometry keep it */
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < n; i++)
+			if (!slot[i] && g[i].x == m->mx && g[i].y == m->my
+			&& g[i].w == m->mw && g[i].h == m->mh) {
+				slot[i] = m;
 				m->num = i;
-				m->mx = m->wx = unique[i].x_org;
-				m->my = m->wy = unique[i].y_org;
-				m->mw = m->ww = unique[i].width;
-				m->mh = m->wh = unique[i].height;
-				updatebarpos(m);
-			}
-		/* removed monitors if n > nn */
-		for (i = nn; i < n; i++) {
-			for (m = mons; m && m->next; m = m->next);
-			while ((c = m->clients)) {
-				dirty = 1;
-				m->clients = c->next;
-				detachstack(c);
-				c->mon = mons;
-				attach(c);
-				attachstack(c);
+				break;
 			}
-			if (m == selmon)
-				selmon = mons;
-			cleanupmon(m);
-		}
-		free(unique);
-	} else
-#endif /* XINERAMA */
-	{ /* default monitor setup */
-		if (!mons)
-			mons = createmon();
-		if (mons->mw != sw || mons->mh != sh) {
-			dirty = 1;
-			mons->mw = mons->ww = sw;
-			mons->mh = mons->wh = sh;
-			updatebarpos(mons);
+	/* the remaining geometries reuse unmatched monitors or get new ones */
+	for (i = 0, m = mons; i < n; i++) {
+		if (slot[i])
+			continue;
+		for (; m && m->num >= 0; m = m->next);
+		slot[i] = m ? m : createmon();
+		slot[i]->num = i;
+		slot[i]->mx = slot[i]->wx = g[i].x;
+		slot[i]->my = slot[i]->wy = g[i].y;
+		slot[i]->mw = slot[i]->ww = g[i].w;
+		slot[i]->mh = slot[i]->wh = g[i].h;
+		slot[i]->dirty = 1;
+		updatebarpos(slot[i]);
+		dirty++;
+	}
+	/* monitors left over were removed, hand their clients to the first one */
+	for (m = mons; m; m = next) {
+		next = m->next;
+		if (m->num >= 0)
+			continue;
+		while ((c = m->clients)) {
+			m->clients = c->next;
+			detachstack(c);
+			c->mon = slot[0];
+			attach(c);
+			attachstack(c);
 		}
+		if (!slot[0]->dirty)
+			dirty++;
+		slot[0]->dirty = 1;
+		if (m == selmon)
+			selmon = slot[0];
+		cleanupmon(m);
 	}
+	/* keep the monitor list in topology order */
+	for (mons = slot[0], i = 0; i < n; i++)
+		slot[i]->next = i + 1 < n ? slot[i + 1] : NULL;
+	free(slot);
+	free(g);
 	if (dirty) {
 		selmon = mons;
 		selmon = wintomon(root);
@@ -2226,37 +4577,37 @@ updatesizehints(Client *c)
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
 	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
+		c->cold->basew = size.base_width;
+		c->cold->baseh = size.base_height;
 	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
+		c->cold->basew = size.min_width;
+		c->cold->baseh = size.min_height;
 	} else
-		c->basew = c->baseh = 0;
+		c->cold->basew = c->cold->baseh = 0;
 	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
+		c->cold->incw = size.width_inc;
+		c->cold->inch = size.height_inc;
 	} else
-		c->incw = c->inch = 0;
+		c->cold->incw = c->cold->inch = 0;
 	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
+		c->cold->maxw = size.max_width;
+		c->cold->maxh = size.max_height;
 	} else
-		c->maxw = c->maxh = 0;
+		c->cold->maxw = c->cold->maxh = 0;
 	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
+		c->cold->minw = size.min_width;
+		c->cold->minh = size.min_height;
 	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
+		c->cold->minw = size.base_width;
+		c->cold->minh = size.base_height;
 	} else
-		c->minw = c->minh = 0;
+		c->cold->minw = c->cold->minh = 0;
 	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+		c->cold->mina = (float)size.min_aspect.y / size.min_aspect.x;
+		c->cold->maxa = (float)size.max_aspect.x / size.max_aspect.y;
 	} else
-		c->maxa = c->mina = 0.0;
-	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
+		c->cold->maxa = c->cold->mina = 0.0;
+	c->isfixed = (c->cold->maxw && c->cold->maxh && c->cold->maxw == c->cold->minw && c->cold->maxh == c->cold->minh);
 	c->hintsvalid = 1;
 }
 
@@ -2271,10 +4622,42 @@ updatestatus(void)
 void
 updatetitle(Client *c)
 {
-	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
-		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
-	if (c->name[0] == '\0') /* hack to mark broken clients */
-		strcpy(c->name, broken);
+	char name[1024];
+	const char *old = c->cold->name;
+
+	c->titledirty = 0;
+	if (!gettextprop(c->win, netatom[NetWMName], name, sizeof name))
+		gettextprop(c->win, XA_WM_NAME, name, sizeof name);
+	if (name[0] == '\0') /* hack to mark broken clients */
+		strcpy(name, broken);
+	c->cold->name = intern(name);
+	unintern(old);
+	if (tracing && c->cold->name != old)
+		tracetitle(c);
+	if (c->titlewatch && c->cold->name != old)
+		applytitlerules(c);
+}
+
+void
+updatetopology(unsigned long data)
+{
+	Client *c;
+	Monitor *m;
+
+	if (!updategeom())
+		return;
+	updatebars();
+	for (m = mons; m; m = m->next) {
+		if (!m->dirty)
+			continue;
+		m->dirty = 0;
+		for (c = m->clients; c; c = c->next)
+			if (c->isfullscreen)
+				resizeclient(c, m->mx, m->my, m->mw, m->mh);
+		XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
+		arrange(m);
+	}
+	focus(NULL);
 }
 
 void
@@ -2311,6 +4694,9 @@ updatewmhints(Client *c)
 void
 view(const Arg *arg)
 {
+	Client *c;
+	int i, tag_num = 0;
+
 	if ((arg->ui & TAGMASK) == selmon->tagset[selmon->seltags])
 		return;
 	
@@ -2320,22 +4706,22 @@ view(const Arg *arg)
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
 		
 		// Find the tag number (1-based) for notification
-		int i, tag_num = 0;
 		for (i = 0; i < LENGTH(tags); i++) {
 			if (arg->ui & (1 << i)) {
 				tag_num = i + 1;
 				break;
 			}
 		}
-		
-		// Notify about tag change
-		if (tag_num > 0) {
-			notify_tag(tag_num);
-		}
 	}
 	
-	focus(NULL);
+	/* return to the window last selected on this tag without searching */
+	c = selmon->tagsel[ffs(selmon->tagset[selmon->seltags]) - 1];
+	focus(c && ISVISIBLE(c) ? c : NULL);
 	arrange(selmon);
+	
+	// Notify about tag change
+	if (tag_num > 0)
+		notify_tag(tag_num, selmon->sel ? selmon->sel->cold->name : NULL);
 }
 
 Client *
@@ -2386,6 +4772,8 @@ xerror(Display *dpy, XErrorEvent *ee)
 		return 0;
 	fprintf(stderr, "DINA: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
+	flight_record(FlightXError, ee->request_code << 8 | ee->error_code, ee->resourceid, NULL);
+	flight_dump();
 	return xerrorxlib(dpy, ee); /* may call exit */
 }
 
@@ -2420,134 +4808,50 @@ void
 loadapptagpersist(void)
 {
 	char *home = getenv("HOME");
-	char path[512];
-	FILE *f;
+	char path[PATH_MAX];
 	
 	if (!home)
 		return;
 	
-	/* Free existing entries if any */
-	if (app_persists) {
-		free(app_persists);
-		app_persists = NULL;
-		n_app_persists = 0;
-	}
-	
 	/* Construct path to persistence file in user's home directory */
 	snprintf(path, sizeof(path), "%s/%s", home, APP_PERSIST_FILE);
 	
 	/* Ensure directory exists */
-	char dir_path[512];
+	char dir_path[PATH_MAX];
 	snprintf(dir_path, sizeof(dir_path), "%s/.config", home);
 	mkdir(dir_path, 0755);
 	snprintf(dir_path, sizeof(dir_path), "%s/.config/dina", home);
 	mkdir(dir_path, 0755);
 	
-	f = fopen(path, "r");
-	if (!f)
-		return;  /* File doesn't exist, that's fine */
-	
-	/* First, count the number of entries (non-comment lines) */
-	char line[1024];
-	int count = 0;
-	
-	while (fgets(line, sizeof(line), f)) {
-		/* Skip comment lines and empty lines */
-		if (line[0] != '#' && line[0] != '\n')
-			count++;
-	}
-	
-	/* Allocate memory for entries */
-	if (count > 0) {
-		app_persists = ecalloc(count, sizeof(AppPersist));
-		rewind(f);
-		
-		/* Now read in the entries */
-		int i = 0;
-		while (fgets(line, sizeof(line), f) && i < count) {
-			/* Skip comment lines and empty lines */
-			if (line[0] == '#' || line[0] == '\n')
-				continue;
-				
-			/* Format: class|instance|tag */
-			char *class_str = strtok(line, "|");
-			char *instance_str = strtok(NULL, "|");
-			char *tag_str = strtok(NULL, "\n");
-			
-			if (class_str && instance_str && tag_str) {
-				strncpy(app_persists[i].class, class_str, sizeof(app_persists[i].class) - 1);
-				strncpy(app_persists[i].instance, instance_str, sizeof(app_persists[i].instance) - 1);
-				app_persists[i].tag = atoi(tag_str);
-				i++;
-			}
-		}
-		n_app_persists = i;  /* In case we didn't read all lines successfully */
-	}
-	
-	fclose(f);
+	persist_load(&layout, path); /* a missing file is fine */
 }
 
 void
 saveapptagpersist(void)
 {
 	char *home = getenv("HOME");
-	char path[512];
-	FILE *f;
-	int i;
+	char path[PATH_MAX];
 	
-	if (!home || !app_persists || n_app_persists == 0)
+	if (!home)
 		return;
+	if (pressured) {
+		defer(DeferPersist);
+		return;
+	}
 	
 	/* Construct path to persistence file in user's home directory */
 	snprintf(path, sizeof(path), "%s/%s", home, APP_PERSIST_FILE);
-	
-	/* Ensure directory exists */
-	char dir_path[512];
-	snprintf(dir_path, sizeof(dir_path), "%s/.config", home);
-	mkdir(dir_path, 0755);
-	snprintf(dir_path, sizeof(dir_path), "%s/.config/dina", home);
-	mkdir(dir_path, 0755);
-	
-	f = fopen(path, "w");
-	if (!f)
-		return;  /* Can't write file */
-	
-	/* Write header and format info */
-	fprintf(f, "# DINA Workspace Layout Configuration\n");
-	fprintf(f, "# Format: application_class|application_instance|workspace_number\n");
-	fprintf(f, "# This file is automatically generated by DINA when you move windows between workspaces\n");
-	fprintf(f, "# The window class and instance are from the X11 WM_CLASS property\n\n");
-	
-	/* Write each entry */
-	for (i = 0; i < n_app_persists; i++) {
-		/* Only write entries for tags 2-9 (don't persist tag 1) */
-		if (app_persists[i].tag > 1) {
-			fprintf(f, "%s|%s|%d\n", 
-				app_persists[i].class, 
-				app_persists[i].instance, 
-				app_persists[i].tag);
-		}
-	}
-	
-	fclose(f);
+	flight_record(FlightPersist, layout.n, 0, NULL);
+	if (persist_save(&layout, path) < 0)
+		fprintf(stderr, "DINA: cannot save %s: %s\n", path, strerror(errno));
 }
 
 int
-findapptagpersist(const char *class, const char *instance)
+findapptagpersist(const char *class, const char *instance, unsigned int hash)
 {
-	int i;
-	
-	if (!app_persists || !class || !instance)
+	if (!class || !instance)
 		return -1;
-	
-	for (i = 0; i < n_app_persists; i++) {
-		if (strcmp(app_persists[i].class, class) == 0 &&
-			strcmp(app_persists[i].instance, instance) == 0) {
-			return i;
-		}
-	}
-	
-	return -1;  /* Not found */
+	return persist_find(&layout, class, strlen(class), instance, strlen(instance), hash);
 }
 
 void
@@ -2555,56 +4859,22 @@ updateapptagpersist(const char *class, const char *instance, int tag)
 {
 	int idx;
 	
+	if (!class || !instance)
+		return;
+
 	/* Handle tag 1 differently - remove from persistence */
 	if (tag <= 1) {
-		if (!class || !instance)
-			return;
-			
-		idx = findapptagpersist(class, instance);
+		idx = findapptagpersist(class, instance,
+			persist_hash(class, strlen(class), instance, strlen(instance)));
 		if (idx >= 0) {
-			/* Remove entry by moving last entry to this position */
-			if (idx < n_app_persists - 1) {
-				/* Copy the last element to this position */
-				strncpy(app_persists[idx].class, app_persists[n_app_persists - 1].class, 
-						sizeof(app_persists[idx].class) - 1);
-				strncpy(app_persists[idx].instance, app_persists[n_app_persists - 1].instance, 
-						sizeof(app_persists[idx].instance) - 1);
-				app_persists[idx].tag = app_persists[n_app_persists - 1].tag;
-			}
-			
-			/* Reduce count */
-			n_app_persists--;
-			
-			/* Save changes */
+			persist_remove(&layout, idx);
 			saveapptagpersist();
 		}
 		return;
 	}
 	
 	/* Normal case for tags 2-9 */
-	if (!class || !instance)
-		return;
-	
-	idx = findapptagpersist(class, instance);
-	
-	if (idx >= 0) {
-		/* Update existing entry */
-		app_persists[idx].tag = tag;
-	} else {
-		/* Add new entry */
-		AppPersist *new_persists = realloc(app_persists, (n_app_persists + 1) * sizeof(AppPersist));
-		
-		if (!new_persists)
-			return;  /* Out of memory */
-		
-		app_persists = new_persists;
-		strncpy(app_persists[n_app_persists].class, class, sizeof(app_persists[n_app_persists].class) - 1);
-		strncpy(app_persists[n_app_persists].instance, instance, sizeof(app_persists[n_app_persists].instance) - 1);
-		app_persists[n_app_persists].tag = tag;
-		n_app_persists++;
-	}
-	
-	/* Save changes */
+	persist_set(&layout, class, instance, tag);
 	saveapptagpersist();
 }
 
@@ -2614,44 +4884,70 @@ notifytagplacement(const char *class, const char *instance, int tag)
 	if (tag <= 1)  /* Don't notify for tag 1 */
 		return;
 	
-	char cmd[512];
-	char app_name[512];
-	
-	/* Use instance as app name, or class if instance is "broken" */
-	if (strcmp(instance, broken) == 0)
-		strncpy(app_name, class, sizeof(app_name) - 1);
-	else
-		strncpy(app_name, instance, sizeof(app_name) - 1);
+	char cmd[256], text[600];
 	
-	/* Create notification command */
+	/* Use instance as app name, or class if instance is "broken";
+	 * both come from the client, so only the tone goes through a shell */
+	snprintf(text, sizeof(text), "%.512s automatically placed on tag %d",
+		strcmp(instance, broken) == 0 ? class : instance, tag);
 	snprintf(cmd, sizeof(cmd), 
-		"play -nq synth 0.1 sine %d sine %d vol 0.3 & spd-say -r -40 \"%s automatically placed on tag %d\"", 
-		400 + (tag * 50), 500 + (tag * 50), app_name, tag);
+		"play -nq synth 0.1 sine %d sine %d vol 0.3", 
+		400 + (tag * 50), 500 + (tag * 50));
 	
 	Arg arg = SHCMD_NOTIFY(cmd);
 	spawn(&arg);
+	notify_say("-40", text);
 }
 
 int
 main(int argc, char *argv[])
 {
+	startupmark(StartMain);
 	if (argc == 2 && !strcmp("-v", argv[1]))
 		die("DINA-"VERSION);
+	else if (argc > 2 && !strcmp("-q", argv[1]))
+		return query(argc - 2, argv + 2);
+	else if (argc == 2 && !strcmp("-r", argv[1]))
+		restoring = 1;
 	else if (argc != 1)
-		die("usage: DINA [-v]");
+		die("usage: DINA [-v] [-r] [-q command [args...]]");
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("DINA: cannot open display");
+	xlib_init(dpy);
 	checkotherwm();
 	setup();
+	startsession();
+	startupmark(StartSetup);
 #ifdef __OpenBSD__
 	if (pledge("stdio rpath proc exec", NULL) == -1)
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
+	startupmark(StartScan);
+	/* the first announcement waits for speech-dispatcher, see bootdone() */
+	fprintf(stderr, "DINA: startup: setup %.1f ms, scan %.1f ms\n",
+		startupms(StartSetup), startupms(StartScan));
 	run();
+	if (restarting)
+		savestate();
 	cleanup();
+	trace_close();
 	XCloseDisplay(dpy);
+	if (restarting) {
+		char *args[] = { argv[0], "-r", NULL };
+
+		/* prefer a freshly installed binary over the one we run from */
+		execvp(argv[0], args);
+		execv("/proc/self/exe", args);
+		die("DINA: restart:");
+	}
+	if (shuttingdown == ShutdownPoweroff || shuttingdown == ShutdownReboot) {
+		const char **cmd = shuttingdown == ShutdownPoweroff ? poweroffcmd : rebootcmd;
+
+		execvp(cmd[0], (char **)cmd);
+		die("DINA: execvp '%s' failed:", cmd[0]);
+	}
 	return EXIT_SUCCESS;
 }
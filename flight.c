@@ -0,0 +1,155 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * A fixed ring of the most recent events, key actions, window changes and
+ * spawned commands.  Only the event loop records, one clock read and a few
+ * stores per entry, so it stays on in production.  flight_dump() only uses
+ * open(), write() and close() and may run from a signal handler; an entry
+ * the crash interrupted may show up half written.
+ */
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flight.h"
+
+#define FLIGHT_SIZE             4096 /* entries, a power of two */
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE  CLOCK_MONOTONIC
+#endif
+
+typedef struct {
+	unsigned long long ns;      /* CLOCK_MONOTONIC_COARSE */
+	unsigned int kind, detail;  /* Flight*, and an X event type, key index, ... */
+	unsigned long id;           /* usually a window */
+	char name[16];
+} FlightEntry;
+
+static FlightEntry ring[FLIGHT_SIZE];
+static unsigned long head;      /* entries recorded so far */
+static char dumppath[PATH_MAX];
+
+static const char *kinds[FlightLast] = {
+	[FlightEvent] = "event", [FlightKey] = "key", [FlightCommand] = "command",
+	[FlightManage] = "manage", [FlightUnmanage] = "unmanage",
+	[FlightPersist] = "persist", [FlightSpawn] = "spawn", [FlightExit] = "exit",
+	[FlightXError] = "xerror",
+};
+
+/* core protocol event types; extension events print as numbers */
+static const char *events[] = {
+	[2] = "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+	"MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+	"KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+	"VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify",
+	"MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+	"ConfigureRequest", "GravityNotify", "ResizeRequest", "CirculateNotify",
+	"CirculateRequest", "PropertyNotify", "SelectionClear",
+	"SelectionRequest", "SelectionNotify", "ColormapNotify", "ClientMessage",
+	"MappingNotify", "GenericEvent",
+};
+
+static char *
+putstr(char *p, const char *s)
+{
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+/* v in base 10 or 16, right aligned in width columns */
+static char *
+putnum(char *p, unsigned long long v, unsigned int base, int width)
+{
+	char tmp[24];
+	int n = 0;
+
+	do
+		tmp[n++] = "0123456789abcdef"[v % base];
+	while ((v /= base));
+	for (; width > n; width--)
+		*p++ = ' ';
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+/* Writes the ring, oldest first, with times relative to the newest entry.
+ * Returns -1 if the file cannot be written. */
+int
+flight_dump(void)
+{
+	char line[128], *p;
+	unsigned long i, n, end = head;
+	unsigned long long last, age;
+	FlightEntry *e;
+	int fd;
+
+	if (!dumppath[0] || (fd = open(dumppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+		return -1;
+	n = end < FLIGHT_SIZE ? end : FLIGHT_SIZE;
+	p = putstr(line, "# DINA flight recorder: last ");
+	p = putnum(p, n, 10, 0);
+	p = putstr(p, " of ");
+	p = putnum(p, end, 10, 0);
+	p = putstr(p, " entries, ms before the newest\n");
+	write(fd, line, p - line);
+	last = n ? ring[(end - 1) & (FLIGHT_SIZE - 1)].ns : 0;
+	for (i = end - n; i != end; i++) {
+		e = &ring[i & (FLIGHT_SIZE - 1)];
+		age = last > e->ns ? last - e->ns : 0;
+		p = putnum(line, age / 1000000, 10, 7);
+		*p++ = '.';
+		*p++ = '0' + age / 100000 % 10;
+		*p++ = '0' + age / 10000 % 10;
+		*p++ = '0' + age / 1000 % 10;
+		*p++ = ' ';
+		p = putstr(p, e->kind < FlightLast ? kinds[e->kind] : "?");
+		*p++ = ' ';
+		if (e->kind == FlightEvent && e->detail < sizeof events / sizeof *events && events[e->detail])
+			p = putstr(p, events[e->detail]);
+		else
+			p = putnum(p, e->detail, 10, 0);
+		p = putstr(p, " 0x");
+		p = putnum(p, e->id, 16, 0);
+		if (e->name[0]) {
+			*p++ = ' ';
+			p = putstr(p, e->name);
+		}
+		*p++ = '\n';
+		write(fd, line, p - line);
+	}
+	close(fd);
+	return 0;
+}
+
+/* sets the file flight_dump() writes */
+void
+flight_init(const char *path)
+{
+	size_t n = strlen(path);
+
+	if (n < sizeof dumppath)
+		memcpy(dumppath, path, n + 1);
+}
+
+void
+flight_record(int kind, unsigned int detail, unsigned long id, const char *name)
+{
+	FlightEntry *e = &ring[head & (FLIGHT_SIZE - 1)];
+	struct timespec ts;
+	int i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	e->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e->kind = kind;
+	e->detail = detail;
+	e->id = id;
+	if (name)
+		for (; i < (int)sizeof e->name - 1 && name[i]; i++)
+			e->name[i] = name[i];
+	e->name[i] = '\0';
+	head++;
+}
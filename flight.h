@@ -0,0 +1,9 @@
+/* See LICENSE file for copyright and license details. */
+
+enum { FlightEvent, FlightKey, FlightCommand, FlightManage, FlightUnmanage,
+       FlightPersist, FlightSpawn, FlightExit, FlightXError, FlightLast }; /* kinds */
+
+/* Flight recorder: the last FLIGHT_SIZE things DINA did, for crash dumps */
+int flight_dump(void);
+void flight_init(const char *path);
+void flight_record(int kind, unsigned int detail, unsigned long id, const char *name);
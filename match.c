@@ -0,0 +1,300 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Window rules compiled into one matcher per field.  A pattern is
+ *
+ *	=text	the whole string equals text (hash table)
+ *	~regex	POSIX extended regular expression (tried one by one)
+ *	text	text occurs somewhere in the string (Aho-Corasick automaton)
+ *
+ * so looking up a string costs its length plus the number of matching
+ * rules, however many exact and substring patterns there are.
+ */
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "util.h"
+
+typedef struct {
+	const char *s;
+	unsigned int hash;
+	int rule, next;
+} Exact;
+
+typedef struct {
+	int child, sibling;   /* trie edges */
+	int fail, dict;       /* failure link, nearest node with output on the fail chain */
+	int out;              /* first Out of this node, or -1 */
+	unsigned char c;
+} Node;
+
+typedef struct {
+	int rule, next;
+} Out;
+
+typedef struct {
+	regex_t re;
+	int rule;
+} Regex;
+
+typedef struct {
+	Exact *exact;
+	int nexact;
+	int *buckets;
+	unsigned int nbuckets;
+	Node *nodes;          /* nodes[0] is the root */
+	int nnodes;
+	Out *outs;
+	int nouts;
+	Regex *regex;
+	int nregex;
+} Field;
+
+struct Matcher {
+	int nrules;
+	unsigned char *need;  /* fields each rule constrains */
+	unsigned char *hits;  /* fields matched so far, scratch for match_rules() */
+	int *touched, ntouched;
+	int *bymask[1 << MatchLast]; /* rules by the fields they constrain */
+	int nbymask[1 << MatchLast];
+	Field field[MatchLast];
+};
+
+static unsigned int
+strhash(const char *s)
+{
+	unsigned int h = 2166136261u; /* FNV-1a */
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+/* make room for element n of an array that doubles at powers of two */
+static void *
+grow(void *p, int n, size_t size)
+{
+	if (n && (n & (n - 1)))
+		return p;
+	if (!(p = realloc(p, (n ? 2 * n : 1) * size)))
+		die("realloc:");
+	return p;
+}
+
+static int
+child(const Field *f, int n, unsigned char c)
+{
+	int k;
+
+	for (k = f->nodes[n].child; k >= 0 && f->nodes[k].c != c; k = f->nodes[k].sibling);
+	return k;
+}
+
+static void
+hit(Matcher *m, int rule, int field, unsigned int ignore, int *out, int *n)
+{
+	if (m->hits[rule] & 1 << field)
+		return;
+	if (!m->hits[rule])
+		m->touched[m->ntouched++] = rule;
+	m->hits[rule] |= 1 << field;
+	if (!(m->need[rule] & ~ignore & ~m->hits[rule]))
+		out[(*n)++] = rule;
+}
+
+void
+match_add(Matcher *m, int rule, int field, const char *pattern)
+{
+	Field *f = &m->field[field];
+	char err[256];
+	int n, k, e;
+
+	if (!pattern || !*pattern)
+		return;
+	m->need[rule] |= 1 << field;
+	switch (*pattern) {
+	case '=':
+		f->exact = grow(f->exact, f->nexact, sizeof(Exact));
+		f->exact[f->nexact].s = pattern + 1;
+		f->exact[f->nexact].hash = strhash(pattern + 1);
+		f->exact[f->nexact++].rule = rule;
+		break;
+	case '~':
+		f->regex = grow(f->regex, f->nregex, sizeof(Regex));
+		if ((e = regcomp(&f->regex[f->nregex].re, pattern + 1, REG_EXTENDED | REG_NOSUB))) {
+			/* the rule keeps needing this field, so it never matches */
+			regerror(e, &f->regex[f->nregex].re, err, sizeof err);
+			fprintf(stderr, "DINA: rule %d: %s: %s\n", rule + 1, pattern + 1, err);
+			break;
+		}
+		f->regex[f->nregex++].rule = rule;
+		break;
+	default:
+		for (n = 0; *pattern; n = k, pattern++) {
+			if ((k = child(f, n, *pattern)) >= 0)
+				continue;
+			f->nodes = grow(f->nodes, f->nnodes, sizeof(Node));
+			k = f->nnodes++;
+			f->nodes[k].child = -1;
+			f->nodes[k].sibling = f->nodes[n].child;
+			f->nodes[k].out = -1;
+			f->nodes[k].c = *pattern;
+			f->nodes[n].child = k;
+		}
+		f->outs = grow(f->outs, f->nouts, sizeof(Out));
+		f->outs[f->nouts].rule = rule;
+		f->outs[f->nouts].next = f->nodes[n].out;
+		f->nodes[n].out = f->nouts++;
+		break;
+	}
+}
+
+/* link failure and output chains and hash the exact patterns */
+void
+match_build(Matcher *m)
+{
+	Field *f;
+	int *queue, head, tail, u, v, k, r;
+	unsigned int i, b;
+
+	for (r = 0; r < m->nrules; r++) {
+		k = m->need[r];
+		m->bymask[k] = grow(m->bymask[k], m->nbymask[k], sizeof(int));
+		m->bymask[k][m->nbymask[k]++] = r;
+	}
+	for (f = m->field; f < m->field + MatchLast; f++) {
+		queue = ecalloc(f->nnodes, sizeof(int));
+		for (v = f->nodes[0].child, tail = 0; v >= 0; v = f->nodes[v].sibling) {
+			f->nodes[v].fail = f->nodes[v].dict = 0;
+			queue[tail++] = v;
+		}
+		for (head = 0; head < tail; head++) {
+			u = queue[head];
+			for (v = f->nodes[u].child; v >= 0; v = f->nodes[v].sibling) {
+				for (k = f->nodes[u].fail; k && child(f, k, f->nodes[v].c) < 0; k = f->nodes[k].fail);
+				k = child(f, k, f->nodes[v].c);
+				f->nodes[v].fail = k < 0 ? 0 : k;
+				k = f->nodes[v].fail;
+				f->nodes[v].dict = f->nodes[k].out >= 0 ? k : f->nodes[k].dict;
+				queue[tail++] = v;
+			}
+		}
+		free(queue);
+
+		for (f->nbuckets = 1; f->nbuckets < 2 * (unsigned int)f->nexact; f->nbuckets *= 2);
+		f->buckets = ecalloc(f->nbuckets, sizeof(int));
+		for (b = 0; b < f->nbuckets; b++)
+			f->buckets[b] = -1;
+		for (i = f->nexact; i-- > 0;) { /* earlier rules first in each chain */
+			b = f->exact[i].hash & (f->nbuckets - 1);
+			f->exact[i].next = f->buckets[b];
+			f->buckets[b] = i;
+		}
+	}
+}
+
+Matcher *
+match_create(int nrules)
+{
+	Matcher *m = ecalloc(1, sizeof(Matcher));
+	int i;
+
+	m->nrules = nrules;
+	m->need = ecalloc(nrules, 1);
+	m->hits = ecalloc(nrules, 1);
+	m->touched = ecalloc(nrules, sizeof(int));
+	for (i = 0; i < MatchLast; i++) {
+		m->field[i].nodes = grow(NULL, 0, sizeof(Node));
+		m->field[i].nodes[0].child = m->field[i].nodes[0].sibling = -1;
+		m->field[i].nodes[0].fail = m->field[i].nodes[0].dict = 0;
+		m->field[i].nodes[0].out = -1;
+		m->field[i].nnodes = 1;
+	}
+	return m;
+}
+
+void
+match_free(Matcher *m)
+{
+	Field *f;
+	int i;
+
+	if (!m)
+		return;
+	for (f = m->field; f < m->field + MatchLast; f++) {
+		for (i = 0; i < f->nregex; i++)
+			regfree(&f->regex[i].re);
+		free(f->exact);
+		free(f->buckets);
+		free(f->nodes);
+		free(f->outs);
+		free(f->regex);
+	}
+	for (i = 0; i < LENGTH(m->bymask); i++)
+		free(m->bymask[i]);
+	free(m->need);
+	free(m->hits);
+	free(m->touched);
+	free(m);
+}
+
+/* Stores the rules matched by str in ascending order in out, which must
+ * have room for every rule, and returns how many there are.  Fields in
+ * ignore count as matched whatever their pattern. */
+int
+match_rules(Matcher *m, const char *const str[MatchLast], unsigned int ignore, int *out)
+{
+	const Field *f;
+	const char *s;
+	unsigned int h, mask;
+	int n = 0, i, j, k, field, t;
+
+	for (mask = 0; mask < LENGTH(m->bymask); mask++)
+		if (!(mask & ~ignore))
+			for (i = 0; i < m->nbymask[mask]; i++)
+				out[n++] = m->bymask[mask][i];
+	for (field = 0; field < MatchLast; field++) {
+		if (ignore & 1 << field)
+			continue;
+		f = &m->field[field];
+		s = str[field] ? str[field] : "";
+		if (f->nexact) {
+			h = strhash(s);
+			for (i = f->buckets[h & (f->nbuckets - 1)]; i >= 0; i = f->exact[i].next)
+				if (f->exact[i].hash == h && !strcmp(f->exact[i].s, s))
+					hit(m, f->exact[i].rule, field, ignore, out, &n);
+		}
+		if (f->nnodes > 1) {
+			for (k = 0; *s; s++) {
+				while (k && child(f, k, *s) < 0)
+					k = f->nodes[k].fail;
+				if ((k = child(f, k, *s)) < 0)
+					k = 0;
+				for (j = f->nodes[k].out >= 0 ? k : f->nodes[k].dict; j; j = f->nodes[j].dict)
+					for (i = f->nodes[j].out; i >= 0; i = f->outs[i].next)
+						hit(m, f->outs[i].rule, field, ignore, out, &n);
+			}
+			s = str[field] ? str[field] : "";
+		}
+		for (i = 0; i < f->nregex; i++)
+			if (!regexec(&f->regex[i].re, s, 0, NULL, 0))
+				hit(m, f->regex[i].rule, field, ignore, out, &n);
+	}
+	while (m->ntouched)
+		m->hits[m->touched[--m->ntouched]] = 0;
+	for (i = 1; i < n; i++) /* few rules match, insertion sort is enough */
+	{
+		for (t = out[i], j = i; j > 0 && out[j - 1] > t; j--)
+			out[j] = out[j - 1];
+		out[j] = t;
+	}
+	return n;
+}
+
+int
+match_uses(const Matcher *m, int rule, int field)
+{
+	return m->need[rule] >> field & 1;
+}
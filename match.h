@@ -0,0 +1,15 @@
+/* See LICENSE file for copyright and license details. */
+
+enum { MatchClass, MatchInstance, MatchTitle, MatchLast }; /* matched fields */
+
+typedef struct Matcher Matcher;
+
+/* Rule compilation */
+Matcher *match_create(int nrules);
+void match_add(Matcher *m, int rule, int field, const char *pattern);
+void match_build(Matcher *m);
+void match_free(Matcher *m);
+
+/* Rule lookup */
+int match_rules(Matcher *m, const char *const str[MatchLast], unsigned int ignore, int *out);
+int match_uses(const Matcher *m, int rule, int field);
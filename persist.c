@@ -0,0 +1,246 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "persist.h"
+#include "util.h"
+
+static void
+addentry(Persist *p, const char *class, size_t classlen,
+         const char *instance, size_t instancelen, unsigned int hash, int tag, int owned)
+{
+	PersistEntry *e;
+	unsigned int i, b;
+
+	if (p->n == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 64;
+		if (!(p->entries = realloc(p->entries, p->cap * sizeof(PersistEntry))))
+			die("realloc:");
+	}
+	if ((unsigned int)p->n >= p->nbuckets) { /* keep chains short, rehash */
+		free(p->buckets);
+		p->nbuckets = p->nbuckets ? p->nbuckets * 2 : 64;
+		p->buckets = ecalloc(p->nbuckets, sizeof(int));
+		for (b = 0; b < p->nbuckets; b++)
+			p->buckets[b] = -1;
+		for (i = 0; i < (unsigned int)p->n; i++) {
+			b = p->entries[i].hash % p->nbuckets;
+			p->entries[i].next = p->buckets[b];
+			p->buckets[b] = i;
+		}
+	}
+	e = &p->entries[p->n];
+	e->class = class;
+	e->classlen = classlen;
+	e->instance = instance;
+	e->instancelen = instancelen;
+	e->tag = tag;
+	e->owned = owned;
+	e->hash = hash;
+	b = e->hash % p->nbuckets;
+	e->next = p->buckets[b];
+	p->buckets[b] = p->n++;
+}
+
+static void
+unlinkentry(Persist *p, int idx)
+{
+	int *ip;
+
+	for (ip = &p->buckets[p->entries[idx].hash % p->nbuckets]; *ip != idx;
+	     ip = &p->entries[*ip].next);
+	*ip = p->entries[idx].next;
+}
+
+int
+persist_find(const Persist *p, const char *class, size_t classlen,
+             const char *instance, size_t instancelen, unsigned int hash)
+{
+	const PersistEntry *e;
+	int i;
+
+	if (!p->nbuckets)
+		return -1;
+	for (i = p->buckets[hash % p->nbuckets]; i >= 0; i = e->next) {
+		e = &p->entries[i];
+		if (e->hash == hash && e->classlen == classlen && e->instancelen == instancelen
+		&& !memcmp(e->class, class, classlen) && !memcmp(e->instance, instance, instancelen))
+			return i;
+	}
+	return -1;
+}
+
+void
+persist_free(Persist *p)
+{
+	int i;
+
+	for (i = 0; i < p->n; i++)
+		if (p->entries[i].owned)
+			free((char *)p->entries[i].class);
+	free(p->entries);
+	free(p->buckets);
+	free(p->buf);
+	memset(p, 0, sizeof(Persist));
+}
+
+/* FNV-1a over "class|instance", compared before the strings themselves */
+unsigned int
+persist_hash(const char *class, size_t classlen, const char *instance, size_t instancelen)
+{
+	unsigned int h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < classlen; i++)
+		h = (h ^ (unsigned char)class[i]) * 16777619u;
+	h = (h ^ '|') * 16777619u;
+	for (i = 0; i < instancelen; i++)
+		h = (h ^ (unsigned char)instance[i]) * 16777619u;
+	return h;
+}
+
+/* Reads path into one buffer and indexes it in one pass without copying
+ * each entry; entries point into the buffer, which belongs to p, so the
+ * file being edited or truncated in place cannot pull it away.
+ * Returns the number of entries, or -1 if the file cannot be read. */
+int
+persist_load(Persist *p, const char *path)
+{
+	struct stat st;
+	const char *s, *end, *eol, *bar1, *bar2, *err, *t, *q;
+	unsigned int hash;
+	size_t len = 0;
+	ssize_t r;
+	int fd, line, tag;
+
+	persist_free(p);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	p->buf = ecalloc(1, st.st_size);
+	/* a file shrinking meanwhile just ends early */
+	while (len < (size_t)st.st_size
+	&& ((r = read(fd, p->buf + len, st.st_size - len)) > 0 || (r < 0 && errno == EINTR)))
+		if (r > 0)
+			len += r;
+	close(fd);
+	end = p->buf + len;
+	for (s = p->buf, line = 1; s < end; s = eol + 1, line++) {
+		if (!(eol = memchr(s, '\n', end - s)))
+			eol = end;
+		t = eol;
+		if (t > s && t[-1] == '\r')
+			t--;
+		/* Skip comment lines and empty lines */
+		if (t == s || *s == '#')
+			continue;
+		/* Format: class|instance|tag */
+		err = NULL;
+		tag = 0;
+		if (!(bar1 = memchr(s, '|', t - s)) || !(bar2 = memchr(bar1 + 1, '|', t - bar1 - 1)))
+			err = "expected class|instance|tag";
+		else if (bar1 == s || bar2 == bar1 + 1)
+			err = "empty class or instance";
+		else {
+			for (q = bar2 + 1; q < t && *q >= '0' && *q <= '9' && tag < 32; q++)
+				tag = tag * 10 + (*q - '0');
+			if (q != t || q == bar2 + 1 || tag < 1 || tag > 31)
+				err = "tag is not a number between 1 and 31";
+		}
+		if (err) {
+			fprintf(stderr, "DINA: %s:%d: %s\n", path, line, err);
+			continue;
+		}
+		/* the first entry for an application wins */
+		hash = persist_hash(s, bar1 - s, bar1 + 1, bar2 - bar1 - 1);
+		if (persist_find(p, s, bar1 - s, bar1 + 1, bar2 - bar1 - 1, hash) < 0)
+			addentry(p, s, bar1 - s, bar1 + 1, bar2 - bar1 - 1, hash, tag, 0);
+	}
+	return p->n;
+}
+
+void
+persist_remove(Persist *p, int idx)
+{
+	int last = p->n - 1;
+
+	unlinkentry(p, idx);
+	if (p->entries[idx].owned)
+		free((char *)p->entries[idx].class);
+	if (idx != last) {
+		/* move the last entry into the hole and relink it there */
+		unlinkentry(p, last);
+		p->entries[idx] = p->entries[last];
+		p->entries[idx].next = p->buckets[p->entries[idx].hash % p->nbuckets];
+		p->buckets[p->entries[idx].hash % p->nbuckets] = idx;
+	}
+	p->n--;
+}
+
+/* Writes a temporary file next to path and renames it into place, so
+ * readers never see a partial file.  A symlinked path is followed first,
+ * and the file it points to replaced, so the link survives. */
+int
+persist_save(const Persist *p, const char *path)
+{
+	char real[PATH_MAX], tmp[PATH_MAX + 8];
+	FILE *f;
+	int i;
+
+	if (realpath(path, real))
+		path = real;
+	if ((size_t)snprintf(tmp, sizeof tmp, "%s.tmp", path) >= sizeof tmp
+	|| !(f = fopen(tmp, "w")))
+		return -1;
+	/* Write header and format info */
+	fprintf(f, "# DINA Workspace Layout Configuration\n");
+	fprintf(f, "# Format: application_class|application_instance|workspace_number\n");
+	fprintf(f, "# This file is automatically generated by DINA when you move windows between workspaces\n");
+	fprintf(f, "# The window class and instance are from the X11 WM_CLASS property\n\n");
+	for (i = 0; i < p->n; i++)
+		/* Only write entries for tags 2-9 (don't persist tag 1) */
+		if (p->entries[i].tag > 1)
+			fprintf(f, "%.*s|%.*s|%d\n",
+				(int)p->entries[i].classlen, p->entries[i].class,
+				(int)p->entries[i].instancelen, p->entries[i].instance,
+				p->entries[i].tag);
+	if (fclose(f) == EOF || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* Adds or updates the entry for class and instance, returns its index */
+int
+persist_set(Persist *p, const char *class, const char *instance, int tag)
+{
+	size_t classlen = strlen(class), instancelen = strlen(instance);
+	unsigned int hash = persist_hash(class, classlen, instance, instancelen);
+	char *s;
+	int idx;
+
+	idx = persist_find(p, class, classlen, instance, instancelen, hash);
+	if (idx >= 0) {
+		p->entries[idx].tag = tag;
+		return idx;
+	}
+	s = ecalloc(1, classlen + instancelen + 2);
+	memcpy(s, class, classlen);
+	memcpy(s + classlen + 1, instance, instancelen);
+	addentry(p, s, classlen, s + classlen + 1, instancelen, hash, tag, 1);
+	return p->n - 1;
+}
@@ -0,0 +1,31 @@
+/* See LICENSE file for copyright and license details. */
+
+typedef struct {
+	const char *class, *instance; /* not terminated, point into buf or own */
+	size_t classlen, instancelen;
+	int tag;                      /* tag number (1-9) */
+	unsigned int hash;            /* persist_hash() of class and instance */
+	int next;                     /* next entry in the same bucket, or -1 */
+	int owned;                    /* class and instance were allocated by persist_set() */
+} PersistEntry;
+
+typedef struct {
+	PersistEntry *entries;
+	int n, cap;
+	int *buckets;                 /* first entry of each hash chain, or -1 */
+	unsigned int nbuckets;
+	char *buf;                    /* the file as loaded, see persist_load() */
+} Persist;
+
+/* Persistence table */
+void persist_free(Persist *p);
+int persist_load(Persist *p, const char *path);
+int persist_save(const Persist *p, const char *path);
+
+/* Entries */
+int persist_find(const Persist *p, const char *class, size_t classlen,
+                 const char *instance, size_t instancelen, unsigned int hash);
+unsigned int persist_hash(const char *class, size_t classlen,
+                          const char *instance, size_t instancelen);
+void persist_remove(Persist *p, int idx);
+int persist_set(Persist *p, const char *class, const char *instance, int tag);
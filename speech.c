@@ -0,0 +1,138 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * A persistent connection to speech-dispatcher speaking SSIP directly, so
+ * an announcement is one write instead of an spd-say process that has to
+ * start, connect, and tear down again every time.
+ *
+ * With ESPEAK, espeak-ng linked in speaks when speech-dispatcher is not
+ * there, from its own thread onto an audio stream it keeps open.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef ESPEAK
+#include <espeak-ng/speak_lib.h>
+#endif
+
+#include "speech.h"
+
+/* $SPEECHD_ADDRESS ("unix_socket:path") or the per-user default socket */
+static int
+speechpath(char *buf, size_t size)
+{
+	const char *s, *dir;
+
+	if ((s = getenv("SPEECHD_ADDRESS")) && !strncmp(s, "unix_socket:", 12))
+		return (size_t)snprintf(buf, size, "%s", s + 12) < size ? 0 : -1;
+	if (!(dir = getenv("XDG_RUNTIME_DIR")))
+		return -1;
+	return (size_t)snprintf(buf, size, "%s/speech-dispatcher/speechd.sock", dir) < size ? 0 : -1;
+}
+
+/* Returns a connected, non-blocking socket or -1.  Replies must be read
+ * and discarded by the caller so they never fill the socket buffer. */
+int
+speech_open(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char hello[128];
+	const char *user;
+	int fd, n;
+
+	if (speechpath(addr.sun_path, sizeof addr.sun_path) < 0)
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	user = getenv("USER");
+	n = snprintf(hello, sizeof hello, "SET self CLIENT_NAME %.64s:dina:main\r\n",
+		user ? user : "user");
+	if (send(fd, hello, n, MSG_NOSIGNAL) != n) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Queues text at rate (-100..100) and returns 0, or -1 if the connection
+ * is gone or would block, in which case the caller closes fd.  Once part
+ * of the message is out, the rest is waited for up to timeout ms so the
+ * server is not left mid-message. */
+int
+speech_say(int fd, const char *rate, const char *text, unsigned int timeout)
+{
+	char buf[2048];
+	size_t n, max, start, off = 0;
+	ssize_t w;
+	struct timespec now;
+	long long deadline = 0, left;
+
+	n = snprintf(buf, sizeof buf, "SET self RATE %.8s\r\nSPEAK\r\n", rate);
+	max = sizeof buf - 6;
+	/* one data line: no line breaks, and a lone dot would end the message */
+	if (!strcmp(text, "."))
+		buf[n++] = '.';
+	for (start = n; *text && n < max; text++)
+		buf[n++] = (*text == '\r' || *text == '\n') ? ' ' : *text;
+	/* cut before the lead byte of a character split by the limit */
+	for (; n > start && ((unsigned char)*text & 0xC0) == 0x80; n--, text--);
+	memcpy(buf + n, "\r\n.\r\n", 5);
+	n += 5;
+	while (off < n) {
+		if ((w = send(fd, buf + off, n - off, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0) {
+			off += w;
+			continue;
+		}
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w == 0 || errno != EAGAIN || !off)
+			return -1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!deadline)
+			deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout;
+		if ((left = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000)) <= 0
+		|| poll(&(struct pollfd){ .fd = fd, .events = POLLOUT }, 1, left) <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+#ifdef ESPEAK
+/* Loads the voice data and opens the audio output.  Returns -1 if espeak-ng
+ * cannot speak; it is not tried again. */
+int
+speech_espeak_open(void)
+{
+	if (espeak_Initialize(AUDIO_OUTPUT_PLAYBACK, 0, NULL, espeakINITIALIZE_DONT_EXIT) < 0)
+		return -1;
+	return espeak_SetVoiceByName("en") == EE_OK ? 0 : -1;
+}
+
+/* Queues text at rate (-100..100) and returns 0, or -1 if espeak-ng is
+ * busy or failed.  Text already queued keeps playing. */
+int
+speech_espeak_say(const char *rate, const char *text)
+{
+	int r = atoi(rate);
+
+	/* the words per minute speech-dispatcher's espeak-ng module uses */
+	r = r < -100 ? -100 : r > 100 ? 100 : r;
+	espeak_SetParameter(espeakRATE, r < 0 ? 175 + r * 95 / 100 : 175 + r * 275 / 100, 0);
+	if (espeak_Synth(text, strlen(text) + 1, 0, POS_CHARACTER, 0, espeakCHARS_UTF8,
+	    NULL, NULL) != EE_OK)
+		return -1;
+	return 0;
+}
+#endif /* ESPEAK */
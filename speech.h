@@ -0,0 +1,11 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Speech Dispatcher connection (SSIP) */
+int speech_open(void);
+int speech_say(int fd, const char *rate, const char *text, unsigned int timeout);
+
+#ifdef ESPEAK
+/* espeak-ng in process, see speak() */
+int speech_espeak_open(void);
+int speech_espeak_say(const char *rate, const char *text);
+#endif
@@ -0,0 +1,130 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Session traces for bench/wm-replay, see trace.h. Records are buffered
+ * and written at least once a second, so a crash loses no more than that.
+ * Unless opened verbatim, strings are replaced by salted hashes of the same
+ * length, so a trace names no documents but still tells windows apart.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "util.h"
+
+#define TRACE_STR               255  /* longest string kept */
+#define TRACE_FLUSH             1000000 /* us between writes */
+
+static FILE *tracefile;
+static unsigned long long last, flushed;
+static int verbatim;
+static uint32_t salt;          /* new for every trace, never written */
+
+/* the same string yields the same hex digits within one trace */
+static void
+anonymize(char *buf, const char *s, size_t n)
+{
+	uint32_t h = salt;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619u;
+	for (i = 0; i < n; i++)
+		buf[i] = "0123456789abcdef"[h >> (i % 8 * 4) & 15];
+}
+
+void
+trace_close(void)
+{
+	if (tracefile)
+		fclose(tracefile);
+	tracefile = NULL;
+}
+
+/* CLOCK_MONOTONIC in microseconds */
+unsigned long long
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Replaces a running trace, keeping strings as they are if raw is set.
+ * Returns -1 with errno set if path cannot be written. */
+int
+trace_open(const char *path, int raw)
+{
+	FILE *f;
+	int fd;
+
+	if (!(f = fopen(path, "we")))
+		return -1;
+	trace_close();
+	tracefile = f;
+	verbatim = raw;
+	if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0
+	|| read(fd, &salt, sizeof salt) != sizeof salt)
+		salt = trace_now() ^ getpid();
+	if (fd >= 0)
+		close(fd);
+	setvbuf(tracefile, NULL, _IOFBF, 1 << 16);
+	fwrite(TRACE_MAGIC, 1, sizeof TRACE_MAGIC - 1, tracefile);
+	last = flushed = trace_now();
+	return 0;
+}
+
+void
+trace_record(unsigned int kind, const void *data, size_t len, const char *strs[], int nstrs)
+{
+	unsigned long long now;
+	TraceRecord r;
+	char buf[TRACE_STR];
+	size_t n[4];
+	int i;
+
+	if (!tracefile)
+		return;
+	now = trace_now();
+	r.dt = now - last < UINT32_MAX ? now - last : UINT32_MAX;
+	r.kind = kind;
+	r.len = len;
+	for (i = 0; i < nstrs && i < (int)LENGTH(n); i++) {
+		n[i] = strs[i] ? strnlen(strs[i], TRACE_STR) : 0;
+		r.len += n[i] + 1;
+	}
+	last = now;
+	fwrite(&r, sizeof r, 1, tracefile);
+	fwrite(data, 1, len, tracefile);
+	for (i = 0; i < nstrs && i < (int)LENGTH(n); i++) {
+		if (verbatim || !n[i])
+			fwrite(strs[i] ? strs[i] : "", 1, n[i], tracefile);
+		else {
+			anonymize(buf, strs[i], n[i]);
+			fwrite(buf, 1, n[i], tracefile);
+		}
+		fputc('\0', tracefile);
+	}
+	if (now - flushed >= TRACE_FLUSH) {
+		fflush(tracefile);
+		flushed = now;
+	}
+}
+
+/* Reads the next record into r and its payload, NUL terminated, into
+ * payload. Returns 1, 0 at the end of the trace or -1 if it is cut short
+ * or a payload is larger than size. */
+int
+trace_read(FILE *f, TraceRecord *r, void *payload, size_t size)
+{
+	if (fread(r, sizeof *r, 1, f) != 1)
+		return feof(f) ? 0 : -1;
+	if (r->len >= size || fread(payload, 1, r->len, f) != r->len)
+		return -1;
+	((char *)payload)[r->len] = '\0';
+	return 1;
+}
@@ -0,0 +1,58 @@
+/* See LICENSE file for copyright and license details. */
+
+/* A session trace is TRACE_MAGIC followed by records, each a TraceRecord
+ * and len bytes of payload in host byte order: one of the Traced* below,
+ * then the NUL terminated strings it names, salted hashes of the same
+ * length unless the trace was opened raw. */
+#define TRACE_MAGIC             "DINATRC2"
+
+enum { TraceEvent, TraceKey, TraceWindow, TraceTitle, TraceLast }; /* record kinds */
+enum { TracePropOther, TracePropName, TracePropHints, TracePropNormalHints,
+       TracePropTransient, TracePropType }; /* PropertyNotify atoms */
+
+typedef struct {
+	uint32_t dt;           /* microseconds since the previous record */
+	uint16_t kind;
+	uint16_t len;
+} TraceRecord;
+
+typedef struct {           /* TraceEvent, written once the handler returned */
+	uint32_t window;       /* the window the event is about, not its parent */
+	uint32_t us;           /* spent in the handler */
+	uint32_t requests;     /* sent by the handler */
+	uint8_t type;
+	uint8_t detail;        /* UnmapNotify: send_event, PropertyNotify: TraceProp* */
+	uint16_t mask;         /* ConfigureRequest: value_mask and geometry */
+	int16_t x, y;
+	uint16_t w, h, bw;
+	uint16_t pad;
+} TracedEvent;
+
+typedef struct {           /* TraceKey, ahead of the TraceEvent of its KeyPress */
+	uint32_t keysym;       /* of the binding, so a changed config.h replays */
+	uint16_t mod;          /* the same keys as long as they stay bound */
+	uint16_t pad;
+} TracedKey;
+
+typedef struct {           /* TraceWindow, then class, instance and title */
+	uint32_t window;
+	uint32_t transient;    /* WM_TRANSIENT_FOR or None */
+	int16_t x, y;
+	uint16_t w, h;
+	uint8_t fixed;         /* minimum and maximum size are the same */
+	uint8_t dialog;        /* _NET_WM_WINDOW_TYPE_DIALOG */
+	uint16_t pad;
+} TracedWindow;
+
+typedef struct {           /* TraceTitle, then the title */
+	uint32_t window;
+} TracedTitle;
+
+/* Writing */
+void trace_close(void);
+unsigned long long trace_now(void);
+int trace_open(const char *path, int raw);
+void trace_record(unsigned int kind, const void *data, size_t len, const char *strs[], int nstrs);
+
+/* Reading */
+int trace_read(FILE *f, TraceRecord *r, void *payload, size_t size);